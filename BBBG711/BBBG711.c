@@ -11,29 +11,68 @@
 	by information in the header.
 */
 #include "stdafx.h"
+#include "resample.h"
+#include "wavfile.h"
+#include "g711.h"
+#include "g711_dispatch.h"
+#include "g711pack.h"
+#include "convcache.h"
+#ifndef UNDER_CE
+#include <io.h>
+#include <fcntl.h>
+#endif
 
-/** @brief prints command line usage to terminal */
-void print_usage(char *program_name)
-{
-    printf("Usage: %s input_file CONVERSION output_file\n", program_name);
-    printf("Supported CONVERSIONs: pcm_alaw, pcm_ulaw, g711_pcm\n");
-}
-/** @brief returns the file size */
-long get_file_size(FILE *f)
-{
-    long file_size;
-
-    /* Go to end of file */
-    fseek(f, 0L, SEEK_END);
-
-    /* Get the number of bytes */
-    file_size = ftell(f);
+/** @brief the only sample rate G.711 is defined at */
+#define G711_RATE 8000
+/** @brief frames converted at a time, which bounds the memory used */
+#define STREAM_BLOCK 4096
+/** @brief frames converted at a time from stdin, small so each one 
+goes out soon after it comes in */
+#define PIPE_BLOCK 160
+/** @brief bytes copied at a time by the editing conversions */
+#define EDIT_BLOCK 65536
+/** @brief bytes at the start of the audio that go into the cache key */
+#define CACHE_KEY_BLOCK 4096
+/** @brief most -append files or -at cuts on one command line */
+#define MAX_PIECES 64
+/** @brief size of the -cache directory unless -cachesize says otherwise */
+#define CACHE_DEFAULT_MB 64
 
-    /* reset the file position indicator to 
-    the beginning of the file */
-    fseek(f, 0L, SEEK_SET);	
+/** @brief where messages go: stdout, or stderr when stdout carries 
+the audio */
+static FILE *msg;
 
-    return file_size;
+/** @brief prints command line usage to msg */
+void print_usage(const wchar_t *program_name)
+{
+    fprintf(msg, "Usage: %ls input_file CONVERSION output_file [-dither] [-rate N] [-channel N]\n", program_name);
+    fprintf(msg, "       [-rf64 | -w64] [-autotune] [-raw] [-threads N]\n");
+    fprintf(msg, "       [-append FILE]... [-start N] [-length N] [-at N]...\n");
+    fprintf(msg, "       [-cache DIR] [-cachesize MB]\n");
+    fprintf(msg, "Supported CONVERSIONs: pcm_alaw, pcm_ulaw, g711_pcm, g711_float,\n");
+    fprintf(msg, "                       g711_g711, pcm_pcm, g711_pack, pack_g711,\n");
+    fprintf(msg, "                       g711_concat, g711_trim, g711_split\n");
+    fprintf(msg, "pcm_alaw and pcm_ulaw accept 16 bit, 24 bit and 32 bit float PCM.\n");
+    fprintf(msg, "-dither applies TPDF dither when reducing 24 bit PCM.\n");
+    fprintf(msg, "-rate resamples the output to N samples/second. G711 output\n");
+    fprintf(msg, "is resampled to 8000 unless -rate says otherwise.\n");
+    fprintf(msg, "-channel N keeps only channel N (1 = left) of the input.\n");
+    fprintf(msg, "g711_g711 and pcm_pcm copy out the -channel without conversion.\n");
+    fprintf(msg, "-rf64 or -w64 write a 64 bit container. Outputs over 4GB\n");
+    fprintf(msg, "are written as RF64 regardless.\n");
+    fprintf(msg, "-autotune times the G711 kernels on this CPU and uses the fastest.\n");
+    fprintf(msg, "input_file or output_file - reads stdin or writes stdout. A header\n");
+    fprintf(msg, "whose lengths are not known yet gets 0xFFFFFFFF in their place.\n");
+    fprintf(msg, "-raw writes the samples without any header.\n");
+    fprintf(msg, "g711_pack compresses G711 losslessly, pack_g711 restores it.\n");
+    fprintf(msg, "-threads N packs on N threads, one per processor by default.\n");
+    fprintf(msg, "g711_concat appends each -append FILE to the input, converting\n");
+    fprintf(msg, "between A-law and u-law if they differ. g711_trim keeps -length N\n");
+    fprintf(msg, "samples from -start N. g711_split cuts at every -at N into\n");
+    fprintf(msg, "output_1, output_2, ... All three copy the G711 bytes as they are.\n");
+    fprintf(msg, "-cache DIR keeps converted files in DIR, and a repeat of the same\n");
+    fprintf(msg, "conversion of the same audio copies the kept file. DIR is trimmed\n");
+    fprintf(msg, "to -cachesize MB (%d by default), least recently used first.\n", CACHE_DEFAULT_MB);
 }
 /** @brief allocates a buffer */
 char * allocate_buffer(long buffer_size)
@@ -46,7 +85,7 @@ char * allocate_buffer(long buffer_size)
     /* memory error */
     if(buffer == NULL)
     {
-        printf("Error while allocating memory for write buffer.\n");
+        fprintf(msg, "Error while allocating memory for write buffer.\n");
         exit(EXIT_FAILURE);
     }
 
@@ -63,7 +102,7 @@ struct PCMheader {
 	uint8_t WAVEfmt[8];
 	/** @brief The size of the fmt chunk in bytes */
 	uint32_t fmtSize;
-	/** @brief usually 1 for PCM */
+	/** @brief 1 for integer PCM, 3 for IEEE float */
 	uint16_t formattag;
 	/** @brief Number of channels.. 
 	usually either 1 for mono or 2 for stereo */
@@ -125,7 +164,7 @@ void initPCMheader(struct PCMheader * header)
 	header->w_data[2]='t';
 	header->w_data[3]='a';
 	header->fmtSize = 16;
-	header->formattag = 1;
+	header->formattag = WAVE_FORMAT_PCM;
 	header->bytes_by_capture = 2;
 	header->bits_per_sample = 16;
 	return;
@@ -162,9 +201,9 @@ struct G711header {
 	uint16_t cfSizeLSB;
 	/** @brief this is the MSB of the size of the next chunk */
 	uint16_t cfSizeMSB;
-	/** @brief this is the LSB of the size of the data in bytes */
+	/** @brief this is the LSB of the number of samples per channel */
 	uint16_t sampleLengthLSB;
-	/** @brief this is the MSB of the size of the data in bytes */
+	/** @brief this is the MSB of the number of samples per channel */
 	uint16_t sampleLengthMSB;
 	/** @brief contains exactly the characters "data" */
 	uint8_t w_data[4];
@@ -238,6 +277,860 @@ void initG711header(struct G711header * header)
 	header->blockAlign2 = 0xFFFF;
 	return;
 }
+/** @brief fills in the size fields of a G711 header for 
+data_bytes bytes of audio. blockAlign must already be set, the fact
+chunk counts samples per channel as wav_write_header() does. */
+void setG711lengths(struct G711header * header, uint32_t data_bytes)
+{
+	uint32_t samples = data_bytes / (header->blockAlign ? header->blockAlign : 1);
+
+	header->sampleLengthLSB = samples&0x0000FFFF;
+	header->sampleLengthMSB = (samples>>16)&0x0000FFFF;
+	header->dataLengthLSB = data_bytes&0x0000FFFF;
+	header->dataLengthMSB = (data_bytes>>16)&0x0000FFFF;
+	header->FileSize = sizeof(*header)+data_bytes;
+}
+/** @brief options that may follow the output file */
+struct options {
+	/** @brief TPDF dither on the 24 bit path */
+	int dither;
+	/** @brief output sample rate, 0 to keep the default */
+	uint32_t rate;
+	/** @brief the one channel to keep (1 = left), 0 for all */
+	int channel;
+	/** @brief WAV_RF64 or WAV_W64 to force a 64 bit container */
+	int container;
+	/** @brief time the kernels at startup and bind the fastest */
+	int autotune;
+	/** @brief write the samples without a header */
+	int raw;
+	/** @brief encoder threads for g711_pack, 0 for one per processor */
+	int threads;
+	/** @brief files g711_concat appends to the input */
+	wchar_t *append[MAX_PIECES];
+	/** @brief number of append */
+	int appends;
+	/** @brief first sample (per channel) g711_trim keeps */
+	uint64_t start;
+	/** @brief samples g711_trim keeps, 0 for all up to the end */
+	uint64_t length;
+	/** @brief samples g711_split cuts before, rising */
+	uint64_t at[MAX_PIECES];
+	/** @brief number of at */
+	int cuts;
+	/** @brief directory of cached conversions, NULL for none */
+	wchar_t *cache;
+	/** @brief bytes the cache may hold */
+	uint64_t cache_bytes;
+};
+/** @brief parses the optional arguments, returns 0 on success */
+int parse_options(int argc, wchar_t *argv[], struct options * opts)
+{
+	int i;
+
+	memset(opts, 0, sizeof(*opts));
+	opts->cache_bytes = (uint64_t)CACHE_DEFAULT_MB << 20;
+	for(i = 4; i < argc; i++)
+	{
+		if(wcscmp(argv[i], L"-dither") == 0)
+		{
+			opts->dither = 1;
+		}
+		else if(wcscmp(argv[i], L"-rate") == 0 && i + 1 < argc)
+		{
+			opts->rate = wcstoul(argv[++i], NULL, 10);
+			if(opts->rate == 0)
+				return -1;
+		}
+		else if(wcscmp(argv[i], L"-channel") == 0 && i + 1 < argc)
+		{
+			opts->channel = wcstol(argv[++i], NULL, 10);
+			if(opts->channel <= 0)
+				return -1;
+		}
+		else if(wcscmp(argv[i], L"-rf64") == 0)
+		{
+			opts->container = WAV_RF64;
+		}
+		else if(wcscmp(argv[i], L"-w64") == 0)
+		{
+			opts->container = WAV_W64;
+		}
+		else if(wcscmp(argv[i], L"-autotune") == 0)
+		{
+			opts->autotune = 1;
+		}
+		else if(wcscmp(argv[i], L"-raw") == 0)
+		{
+			opts->raw = 1;
+		}
+		else if(wcscmp(argv[i], L"-threads") == 0 && i + 1 < argc)
+		{
+			opts->threads = wcstol(argv[++i], NULL, 10);
+			if(opts->threads <= 0)
+				return -1;
+		}
+		else if(wcscmp(argv[i], L"-append") == 0 && i + 1 < argc && opts->appends < MAX_PIECES)
+		{
+			opts->append[opts->appends++] = argv[++i];
+		}
+		else if(wcscmp(argv[i], L"-start") == 0 && i + 1 < argc)
+		{
+			opts->start = _wcstoui64(argv[++i], NULL, 10);
+		}
+		else if(wcscmp(argv[i], L"-length") == 0 && i + 1 < argc)
+		{
+			opts->length = _wcstoui64(argv[++i], NULL, 10);
+			if(opts->length == 0)
+				return -1;
+		}
+		else if(wcscmp(argv[i], L"-at") == 0 && i + 1 < argc && opts->cuts < MAX_PIECES)
+		{
+			opts->at[opts->cuts] = _wcstoui64(argv[++i], NULL, 10);
+			if(opts->at[opts->cuts] == 0 || (opts->cuts > 0 && opts->at[opts->cuts] <= opts->at[opts->cuts - 1]))
+				return -1;
+			opts->cuts++;
+		}
+		else if(wcscmp(argv[i], L"-cache") == 0 && i + 1 < argc)
+		{
+			opts->cache = argv[++i];
+		}
+		else if(wcscmp(argv[i], L"-cachesize") == 0 && i + 1 < argc)
+		{
+			opts->cache_bytes = (uint64_t)wcstoul(argv[++i], NULL, 10) << 20;
+			if(opts->cache_bytes == 0)
+				return -1;
+		}
+		else
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+/** @brief sample formats the conversions move between */
+enum sample_format { FMT_ALAW, FMT_ULAW, FMT_PCM16, FMT_PCM24, FMT_FLOAT32, FMT_NONE };
+/** @brief bytes in one sample of each sample_format */
+static const int format_size[] = { 1, 1, 2, 3, 4, 0 };
+/** @brief the signature shared by the conversion kernels */
+typedef void (*kernel)(int, const char *, char *);
+/** @brief the signature shared by the single channel kernels */
+typedef void (*strided_kernel)(int, const char *, int, char *, int);
+/** @brief one conversion from the input to the output format. Audio 
+goes through it one block at a time, so memory stays bounded 
+however long the file is. */
+struct pipeline {
+	/** @brief bytes per input sample */
+	int in_size;
+	/** @brief bytes per output sample */
+	int out_size;
+	/** @brief interleaved channels in the input */
+	int channels;
+	/** @brief channel kept by -channel (1 = left), 0 for all */
+	int channel;
+	/** @brief set when the sample rate changes */
+	int resample;
+	/** @brief the resampler, if resample is set */
+	struct resampler rs;
+	/** @brief input to output at the same rate, NULL to copy */
+	kernel direct;
+	/** @brief single channel version of direct, NULL if there is none */
+	strided_kernel strided;
+	/** @brief input to pcm16 ahead of the resampler, NULL to copy */
+	kernel to_pcm16;
+	/** @brief pcm16 to output after the resampler, NULL to copy */
+	kernel from_pcm16;
+	/** @brief block of pcm16 ahead of the resampler */
+	short *pcm16;
+	/** @brief block of pcm16 after the resampler */
+	short *resampled;
+};
+/** @brief maps the format of a wav file to a sample_format */
+enum sample_format wav_sample_format(const struct wav_format * fmt)
+{
+	if(fmt->formattag == WAVE_FORMAT_ALAW && fmt->bits_per_sample == 8)
+		return FMT_ALAW;
+	if(fmt->formattag == WAVE_FORMAT_MULAW && fmt->bits_per_sample == 8)
+		return FMT_ULAW;
+	if(fmt->formattag == WAVE_FORMAT_PCM && fmt->bits_per_sample == 16)
+		return FMT_PCM16;
+	if(fmt->formattag == WAVE_FORMAT_PCM && fmt->bits_per_sample == 24)
+		return FMT_PCM24;
+	if(fmt->formattag == WAVE_FORMAT_IEEE_FLOAT && fmt->bits_per_sample == 32)
+		return FMT_FLOAT32;
+	return FMT_NONE;
+}
+/** @brief most frames one block, or the flush at the end, can give */
+int pipeline_max_output(const struct pipeline * p)
+{
+	int block = resampler_max_output(&p->rs, STREAM_BLOCK);
+	int flush = resampler_max_output(&p->rs, p->rs.taps);
+
+	return block > flush ? block : flush;
+}
+/** @brief picks the kernels for in -> out and builds their tables. 
+returns 0 on success, -1 if there is no such conversion */
+int setup_pipeline(struct pipeline * p, enum sample_format in, enum sample_format out,
+	int channels, int channel, uint32_t in_rate, uint32_t out_rate)
+{
+	static const kernel to_pcm16[] = { alaw_to_pcm16, ulaw_to_pcm16, NULL, pcm24_to_pcm16, float32_to_pcm16 };
+	static const kernel from_pcm16[] = { pcm16_to_alaw, pcm16_to_ulaw, NULL, NULL, pcm16_to_float32 };
+	static const kernel encode[][2] = {
+		{ NULL, NULL },
+		{ NULL, NULL },
+		{ pcm16_to_alaw, pcm16_to_ulaw },
+		{ pcm24_to_alaw, pcm24_to_ulaw },
+		{ float32_to_alaw, float32_to_ulaw } };
+
+	memset(p, 0, sizeof(*p));
+	p->in_size = format_size[in];
+	p->out_size = format_size[out];
+	p->channels = channels;
+	p->channel = channel;
+	p->resample = in_rate != out_rate;
+
+	if(in == out)
+	{
+		/* straight copy */
+	}
+	else if(out == FMT_ALAW || out == FMT_ULAW)
+	{
+		p->direct = encode[in][out];
+		if(in == FMT_PCM16)
+			p->strided = out == FMT_ALAW ? pcm16_to_alaw_strided : pcm16_to_ulaw_strided;
+	}
+	else if(in == FMT_ALAW || in == FMT_ULAW)
+	{
+		if(out == FMT_PCM16)
+		{
+			p->direct = to_pcm16[in];
+			p->strided = in == FMT_ALAW ? alaw_to_pcm16_strided : ulaw_to_pcm16_strided;
+		}
+		else if(out == FMT_FLOAT32)
+		{
+			p->direct = in == FMT_ALAW ? alaw_to_float32 : ulaw_to_float32;
+		}
+	}
+	if(in != out && p->direct == NULL && !p->resample)
+		return -1;
+
+	if(p->resample)
+	{
+		if(out == FMT_PCM24)
+			return -1;
+		p->to_pcm16 = to_pcm16[in];
+		p->from_pcm16 = from_pcm16[out];
+		if(resampler_init(&p->rs, in_rate, out_rate, channel ? 1 : channels) != 0)
+			return -1;
+		p->pcm16 = (short *)allocate_buffer(STREAM_BLOCK * channels * sizeof(short));
+		p->resampled = (short *)allocate_buffer(pipeline_max_output(p) * channels * sizeof(short));
+	}
+
+	/* only the tables this conversion reads */
+	if(in == FMT_ALAW)
+	{
+		alaw_pcm16_tableinit();
+		alaw_float32_tableinit();
+	}
+	else if(in == FMT_ULAW)
+	{
+		ulaw_pcm16_tableinit();
+		ulaw_float32_tableinit();
+	}
+	if(out == FMT_ALAW)
+		pcm16_alaw_tableinit();
+	else if(out == FMT_ULAW)
+		pcm16_ulaw_tableinit();
+	return 0;
+}
+/** @brief number of frames the pipeline turns in_frames into */
+uint64_t pipeline_frames(const struct pipeline * p, uint64_t in_frames)
+{
+	if(!p->resample)
+		return in_frames;
+	/* the resampler emits one frame per down steps of up */
+	return (in_frames * p->rs.up + p->rs.down - 1) / p->rs.down;
+}
+/** @brief upper bound on the output bytes of one block */
+long pipeline_block_bytes(const struct pipeline * p)
+{
+	int frames = p->resample ? pipeline_max_output(p) : STREAM_BLOCK;
+
+	return (long)frames * (p->channel ? 1 : p->channels) * p->out_size;
+}
+/** @brief converts one block of frames from src into dst and returns 
+the number of bytes written. src may be overwritten. */
+long run_pipeline(struct pipeline * p, char *src, int frames, char *dst)
+{
+	int out_channels = p->channel ? 1 : p->channels;
+	int samples, out;
+
+	if(p->channel)
+	{
+		src += (p->channel - 1) * p->in_size;
+		if(!p->resample && p->strided)
+		{
+			/* fused: the other channels are never read */
+			p->strided(frames, src, p->channels, dst, 1);
+			return (long)frames * p->out_size;
+		}
+		if(!p->resample && p->direct == NULL)
+		{
+			copy_strided(frames, p->in_size, src, p->channels, dst, 1);
+			return (long)frames * p->out_size;
+		}
+		/* compact the channel in place for the kernels below */
+		copy_strided(frames, p->in_size, src, p->channels, src - (p->channel - 1) * p->in_size, 1);
+		src -= (p->channel - 1) * p->in_size;
+	}
+	samples = frames * out_channels;
+	if(!p->resample)
+	{
+		if(p->direct)
+			p->direct(samples * p->in_size, src, dst);
+		else
+			memcpy(dst, src, samples * p->in_size);
+		return (long)samples * p->out_size;
+	}
+	if(p->to_pcm16)
+		p->to_pcm16(samples * p->in_size, src, (char *)p->pcm16);
+	else
+		memcpy(p->pcm16, src, samples * 2);
+	out = resampler_process(&p->rs, p->pcm16, frames, p->resampled) * out_channels;
+	if(p->from_pcm16)
+		p->from_pcm16(out * 2, (const char *)p->resampled, dst);
+	else
+		memcpy(dst, p->resampled, out * 2);
+	return (long)out * p->out_size;
+}
+/** @brief ends the stream: converts what the resampler still holds 
+into dst and returns the number of bytes written */
+long flush_pipeline(struct pipeline * p, char *dst)
+{
+	int out;
+
+	if(!p->resample)
+		return 0;
+	out = resampler_flush(&p->rs, p->resampled) * (p->channel ? 1 : p->channels);
+	if(p->from_pcm16)
+		p->from_pcm16(out * 2, (const char *)p->resampled, dst);
+	else
+		memcpy(dst, p->resampled, out * 2);
+	return (long)out * p->out_size;
+}
+/** @brief releases the resampler and block buffers */
+void free_pipeline(struct pipeline * p)
+{
+	if(p->resample)
+		resampler_free(&p->rs);
+	free(p->pcm16);
+	free(p->resampled);
+}
+/** @brief writes the output header. Files that fit in 32 bits get the 
+same RIFF headers as always, anything bigger goes to RF64. A length of
+WAV_SIZE_UNKNOWN is written as 0xFFFFFFFF. verbose prints the header. */
+void write_header(FILE *f, const struct wav_format * fmt, int verbose)
+{
+	struct PCMheader pcm_header;
+	struct G711header g711_header;
+	struct wav_format big;
+	int unknown = fmt->data_bytes == WAV_SIZE_UNKNOWN;
+
+	if(fmt->container != WAV_RIFF || (!unknown && fmt->data_bytes > 0xFFFFFFFFUL - sizeof(g711_header)))
+	{
+		big = *fmt;
+		if(big.container == WAV_RIFF)
+			big.container = WAV_RF64;
+		if(verbose)
+			wav_print(&big);
+		if(wav_write_header(f, &big) != 0)
+		{
+			fprintf(msg, "Error while writing the header.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	else if(fmt->formattag == WAVE_FORMAT_ALAW || fmt->formattag == WAVE_FORMAT_MULAW)
+	{
+		initG711header(&g711_header);
+		g711_header.formattag = fmt->formattag;
+		g711_header.nChannels = fmt->nChannels;
+		g711_header.frequency = fmt->frequency;
+		g711_header.bytes_per_second = fmt->frequency*fmt->nChannels;
+		g711_header.blockAlign = fmt->nChannels;
+		setG711lengths(&g711_header, unknown ? 0xFFFFFFFFUL : (uint32_t)fmt->data_bytes);
+		if(unknown)
+		{
+			g711_header.FileSize = 0xFFFFFFFFUL;
+			g711_header.sampleLengthLSB = 0xFFFF;
+			g711_header.sampleLengthMSB = 0xFFFF;
+		}
+		if(verbose)
+			printG711header(g711_header);
+		fwrite (&g711_header , 1, sizeof(g711_header), f);
+	}
+	else
+	{
+		initPCMheader(&pcm_header);
+		pcm_header.formattag = fmt->formattag;
+		pcm_header.nChannels = fmt->nChannels;
+		pcm_header.frequency = fmt->frequency;
+		pcm_header.bits_per_sample = fmt->bits_per_sample;
+		pcm_header.bytes_by_capture = fmt->nChannels*(fmt->bits_per_sample/8);
+		pcm_header.bytes_per_second = fmt->frequency*pcm_header.bytes_by_capture;
+		pcm_header.bytes_in_data = unknown ? 0xFFFFFFFFUL : (uint32_t)fmt->data_bytes;
+		pcm_header.FileSize = unknown ? 0xFFFFFFFFUL : sizeof(pcm_header)+pcm_header.bytes_in_data;
+		if(verbose)
+			printPCMheader(pcm_header);
+		fwrite (&pcm_header , 1, sizeof(pcm_header), f);
+	}
+}
+/** @brief stops the C runtime translating line ends on stdin or 
+stdout, which carry binary audio in pipe mode */
+void set_binary(FILE *f)
+{
+#ifndef UNDER_CE
+	_setmode(_fileno(f), _O_BINARY);
+#endif
+}
+/** @brief opens the output file, - for stdout */
+FILE * open_output(const wchar_t *name)
+{
+	FILE *f;
+
+	if(wcscmp(name, L"-") == 0)
+	{
+		set_binary(stdout);
+		return stdout;
+	}
+	/* open a file for writing */
+	f = _wfopen(name, L"wb");
+
+    /* quit if the file can not be opened */
+    if( f == NULL )
+    {
+       fprintf(msg, "Error while opening the write file.\n");
+       exit(EXIT_FAILURE);
+    }
+	return f;
+}
+/** @brief fills in the length of an output whose header went out 
+before it was known, if the output can seek back */
+void patch_header(FILE *f, struct wav_format * fmt, uint64_t written)
+{
+	fmt->data_bytes = written;
+	if(fmt->container == WAV_RIFF && written > 0xFFFFFFFFUL - sizeof(struct G711header))
+		fprintf(msg, "Output is too long for its RIFF header, the length stays unknown.\n");
+	else if(f != stdout && fseek(f, 0L, SEEK_SET) == 0)
+		write_header(f, fmt, 0);
+}
+/** @brief g711_pack: compresses the G711 audio of fRead losslessly */
+int pack_file(FILE *fRead, const struct wav_format * in_fmt, const wchar_t *out_name, const struct options * opts)
+{
+	FILE *fWrite;
+	int threads = opts->threads;
+	uint64_t packed = 0;
+	SYSTEM_INFO info;
+
+	if(in_fmt->formattag != WAVE_FORMAT_ALAW && in_fmt->formattag != WAVE_FORMAT_MULAW)
+	{
+		fprintf(msg, "Input file is not G711 encoded.\n");
+		exit(EXIT_FAILURE);
+	}
+	if(threads == 0)
+	{
+		GetSystemInfo(&info);
+		threads = info.dwNumberOfProcessors;
+	}
+	fWrite = open_output(out_name);
+	if(g711pack_encode(fRead, in_fmt, fWrite, threads, &packed) != 0)
+	{
+		fprintf(msg, "Error while packing the output.\n");
+		exit(EXIT_FAILURE);
+	}
+	if(fRead != stdin)
+		fclose(fRead);
+	if(fWrite != stdout)
+		fclose(fWrite);
+	else
+		fflush(fWrite);
+	fprintf(msg, "Packed on %d threads into %.0f bytes\n", threads, (double)packed);
+	return 0;
+}
+/** @brief pack_g711: restores the G711 wav that g711_pack compressed */
+int unpack_file(FILE *fRead, const wchar_t *out_name, const struct options * opts)
+{
+	FILE *fWrite;
+	struct g711pack_reader r;
+	struct wav_format fmt;
+	unsigned char *buffer;
+	uint64_t written = 0;
+	int samples;
+
+	switch(g711pack_open(fRead, &r))
+	{
+	case 0:
+		break;
+	case G711PACK_NOT_PACKED:
+		fprintf(msg, "Input is not a packed G711 file.\n");
+		exit(EXIT_FAILURE);
+	case G711PACK_UNSUPPORTED:
+		fprintf(msg, "Unsupported packed G711 file.\n");
+		exit(EXIT_FAILURE);
+	default:
+		fprintf(msg, "Error while allocating memory for the packed file.\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.container = opts->container;
+	fmt.formattag = r.formattag;
+	fmt.nChannels = r.nChannels;
+	fmt.frequency = r.frequency;
+	fmt.bits_per_sample = 8;
+	fmt.data_bytes = r.indexed ? r.samples * r.nChannels + r.tail_bytes : WAV_SIZE_UNKNOWN;
+
+	fWrite = open_output(out_name);
+	if(!opts->raw)
+		write_header(fWrite, &fmt, fWrite != stdout);
+	buffer = (unsigned char *)allocate_buffer(r.frame_samples * r.nChannels);
+	while((samples = g711pack_read_frame(&r, buffer)) > 0)
+	{
+		if(fwrite(buffer, r.nChannels, samples, fWrite) != (size_t)samples)
+		{
+			fprintf(msg, "Error while writing the output.\n");
+			exit(EXIT_FAILURE);
+		}
+		written += (uint64_t)samples * r.nChannels;
+	}
+	/* the part sample the index carries, if the input ended in one */
+	if(samples == 0 && r.tail_bytes > 0)
+	{
+		if(fwrite(r.tail, 1, r.tail_bytes, fWrite) != r.tail_bytes)
+		{
+			fprintf(msg, "Error while writing the output.\n");
+			exit(EXIT_FAILURE);
+		}
+		written += r.tail_bytes;
+	}
+	/* frames that are missing but still parse leave the header wrong */
+	if(samples < 0 || (fmt.data_bytes != WAV_SIZE_UNKNOWN && written != fmt.data_bytes))
+	{
+		fprintf(msg, "The packed file is damaged.\n");
+		exit(EXIT_FAILURE);
+	}
+	if(fmt.data_bytes == WAV_SIZE_UNKNOWN && !opts->raw)
+		patch_header(fWrite, &fmt, written);
+	if(fRead != stdin)
+		fclose(fRead);
+	if(fWrite != stdout)
+		fclose(fWrite);
+	else
+		fflush(fWrite);
+	fprintf(msg, "Bytes written: %.0f\n", (double)written);
+	free(buffer);
+	g711pack_close(&r);
+	return 0;
+}
+/** @brief copies bytes of G711 audio from in to out, through map 
+(NULL to copy them as they are). WAV_SIZE_UNKNOWN copies to the end. 
+returns the bytes copied, or WAV_SIZE_UNKNOWN on error. */
+uint64_t copy_payload(FILE *in, uint64_t bytes, FILE *out, const unsigned char *map)
+{
+	unsigned char *buffer = (unsigned char *)allocate_buffer(EDIT_BLOCK);
+	uint64_t copied = 0;
+	size_t n, got, i;
+
+	while(copied < bytes)
+	{
+		n = bytes - copied > EDIT_BLOCK ? EDIT_BLOCK : (size_t)(bytes - copied);
+		got = fread(buffer, 1, n, in);
+		if(got != n && (bytes != WAV_SIZE_UNKNOWN || ferror(in)))
+		{
+			copied = WAV_SIZE_UNKNOWN;
+			break;
+		}
+		if(map != NULL)
+		{
+			for(i = 0; i < got; i++)
+				buffer[i] = map[buffer[i]];
+		}
+		if(fwrite(buffer, 1, got, out) != got)
+		{
+			copied = WAV_SIZE_UNKNOWN;
+			break;
+		}
+		copied += got;
+		if(got != n)
+			break;
+	}
+	free(buffer);
+	return copied;
+}
+/** @brief quits unless fmt is G711 */
+void require_g711(const struct wav_format * fmt)
+{
+	if(fmt->formattag != WAVE_FORMAT_ALAW && fmt->formattag != WAVE_FORMAT_MULAW)
+	{
+		fprintf(msg, "Input file is not G711 encoded.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+/** @brief g711_concat: the input followed by every -append file. The 
+first file decides the law, the others are converted to it byte by
+byte with alaw2ulaw/ulaw2alaw when theirs differs. */
+int concat_files(FILE *fRead, const struct wav_format * in_fmt, const wchar_t *out_name, const struct options * opts)
+{
+	FILE *inputs[MAX_PIECES + 1];
+	struct wav_format fmts[MAX_PIECES + 1];
+	struct wav_format out_fmt = *in_fmt;
+	unsigned char to_other[256];
+	FILE *fWrite;
+	uint64_t copied, written = 0;
+	int i, c;
+
+	inputs[0] = fRead;
+	fmts[0] = *in_fmt;
+	for(i = 1; i <= opts->appends; i++)
+	{
+		fprintf(msg, "appending %ls\n", opts->append[i - 1]);
+		inputs[i] = _wfopen(opts->append[i - 1], L"rb");
+		if(inputs[i] == NULL || wav_read_header(inputs[i], &fmts[i]) != 0)
+		{
+			fprintf(msg, "Error while opening or reading %ls.\n", opts->append[i - 1]);
+			exit(EXIT_FAILURE);
+		}
+		require_g711(&fmts[i]);
+		if(fmts[i].nChannels != in_fmt->nChannels || fmts[i].frequency != in_fmt->frequency)
+		{
+			fprintf(msg, "%ls does not have the channels and rate of the input.\n", opts->append[i - 1]);
+			exit(EXIT_FAILURE);
+		}
+		/* one stream of unknown length leaves the total unknown */
+		if(fmts[i].data_bytes == WAV_SIZE_UNKNOWN || out_fmt.data_bytes == WAV_SIZE_UNKNOWN)
+			out_fmt.data_bytes = WAV_SIZE_UNKNOWN;
+		else
+			out_fmt.data_bytes += fmts[i].data_bytes;
+	}
+	for(c = 0; c < 256; c++)
+		to_other[c] = in_fmt->formattag == WAVE_FORMAT_ALAW ?
+			ulaw2alaw((unsigned char)c) : alaw2ulaw((unsigned char)c);
+
+	out_fmt.container = opts->container;
+	fWrite = open_output(out_name);
+	if(!opts->raw)
+		write_header(fWrite, &out_fmt, fWrite != stdout);
+	for(i = 0; i <= opts->appends; i++)
+	{
+		copied = copy_payload(inputs[i], fmts[i].data_bytes, fWrite,
+			fmts[i].formattag == in_fmt->formattag ? NULL : to_other);
+		if(copied == WAV_SIZE_UNKNOWN)
+		{
+			fprintf(msg, "Error while copying the audio.\n");
+			exit(EXIT_FAILURE);
+		}
+		written += copied;
+		if(inputs[i] != stdin)
+			fclose(inputs[i]);
+	}
+	if(out_fmt.data_bytes == WAV_SIZE_UNKNOWN && !opts->raw)
+		patch_header(fWrite, &out_fmt, written);
+	if(fWrite != stdout)
+		fclose(fWrite);
+	else
+		fflush(fWrite);
+	fprintf(msg, "Bytes written: %.0f\n", (double)written);
+	return 0;
+}
+/** @brief writes samples [first, first + count) of the input, which is
+positioned at sample first, to a new file. count may be WAV_SIZE_UNKNOWN 
+for the rest of a stream. returns the bytes written. */
+uint64_t write_piece(FILE *fRead, const struct wav_format * in_fmt, uint64_t count, 
+	const wchar_t *out_name, const struct options * opts)
+{
+	struct wav_format out_fmt = *in_fmt;
+	FILE *fWrite;
+	uint64_t written;
+
+	out_fmt.container = opts->container;
+	out_fmt.data_bytes = count == WAV_SIZE_UNKNOWN ? count : count * in_fmt->nChannels;
+	fWrite = open_output(out_name);
+	if(!opts->raw)
+		write_header(fWrite, &out_fmt, fWrite != stdout);
+	written = copy_payload(fRead, out_fmt.data_bytes, fWrite, NULL);
+	if(written == WAV_SIZE_UNKNOWN)
+	{
+		fprintf(msg, "Error while copying the audio.\n");
+		exit(EXIT_FAILURE);
+	}
+	if(out_fmt.data_bytes == WAV_SIZE_UNKNOWN && !opts->raw)
+		patch_header(fWrite, &out_fmt, written);
+	if(fWrite != stdout)
+		fclose(fWrite);
+	else
+		fflush(fWrite);
+	return written;
+}
+/** @brief samples per channel in the input, WAV_SIZE_UNKNOWN for a
+stream of unknown length */
+uint64_t input_samples(const struct wav_format * fmt)
+{
+	return fmt->data_bytes == WAV_SIZE_UNKNOWN ? WAV_SIZE_UNKNOWN : fmt->data_bytes / fmt->nChannels;
+}
+/** @brief g711_trim: keeps -length samples from -start */
+int trim_file(FILE *fRead, const struct wav_format * in_fmt, const wchar_t *out_name, const struct options * opts)
+{
+	uint64_t samples = input_samples(in_fmt);
+	uint64_t count = opts->length ? opts->length : WAV_SIZE_UNKNOWN;
+
+	if(samples != WAV_SIZE_UNKNOWN)
+	{
+		if(opts->start >= samples || (opts->length && opts->length > samples - opts->start))
+		{
+			fprintf(msg, "The input has only %.0f samples.\n", (double)samples);
+			exit(EXIT_FAILURE);
+		}
+		if(!opts->length)
+			count = samples - opts->start;
+	}
+	if(wav_skip(fRead, opts->start * in_fmt->nChannels) != 0)
+	{
+		fprintf(msg, "The input ends before sample %.0f.\n", (double)opts->start);
+		exit(EXIT_FAILURE);
+	}
+	fprintf(msg, "Bytes written: %.0f\n", (double)write_piece(fRead, in_fmt, count, out_name, opts));
+	if(fRead != stdin)
+		fclose(fRead);
+	return 0;
+}
+/** @brief output with _piece put in front of the extension */
+void piece_name(const wchar_t *name, int piece, wchar_t *out, size_t size)
+{
+	const wchar_t *dot = wcsrchr(name, L'.');
+	wchar_t digits[12];
+	int n = 0;
+	size_t stem = dot ? (size_t)(dot - name) : wcslen(name);
+
+	do
+	{
+		digits[n++] = (wchar_t)(L'0' + piece % 10);
+		piece /= 10;
+	} while(piece > 0);
+	if(stem + n + 2 + (dot ? wcslen(dot) : 0) > size)
+	{
+		fprintf(msg, "Output name too long.\n");
+		exit(EXIT_FAILURE);
+	}
+	wcsncpy(out, name, stem);
+	out[stem++] = L'_';
+	while(n > 0)
+		out[stem++] = digits[--n];
+	out[stem] = 0;
+	if(dot)
+		wcscat(out, dot);
+}
+/** @brief g711_split: cuts the input before every -at sample */
+int split_file(FILE *fRead, const struct wav_format * in_fmt, const wchar_t *out_name, const struct options * opts)
+{
+	uint64_t samples = input_samples(in_fmt);
+	uint64_t from = 0, to;
+	wchar_t name[MAX_PATH];
+	int i;
+
+	if(opts->cuts == 0 || wcscmp(out_name, L"-") == 0)
+	{
+		fprintf(msg, "g711_split needs -at and an output file name.\n");
+		exit(EXIT_FAILURE);
+	}
+	if(samples != WAV_SIZE_UNKNOWN && opts->at[opts->cuts - 1] >= samples)
+	{
+		fprintf(msg, "The input has only %.0f samples.\n", (double)samples);
+		exit(EXIT_FAILURE);
+	}
+	for(i = 0; i <= opts->cuts; i++)
+	{
+		to = i < opts->cuts ? opts->at[i] : samples;
+		piece_name(out_name, i + 1, name, MAX_PATH);
+		fprintf(msg, "writing %ls\n", name);
+		write_piece(fRead, in_fmt, to == WAV_SIZE_UNKNOWN ? to : to - from, name, opts);
+		from = to;
+	}
+	if(fRead != stdin)
+		fclose(fRead);
+	return 0;
+}
+/** @brief the cache key of a conversion: the input format and length,
+the first CACHE_KEY_BLOCK bytes of audio, the conversion and every
+option but the cache ones, and the kernel version. Goes back to the
+audio after, so fRead must be able to seek. */
+uint64_t conversion_key(FILE *fRead, const struct wav_format * in_fmt, int argc, wchar_t *argv[])
+{
+	unsigned char *buffer = (unsigned char *)allocate_buffer(CACHE_KEY_BLOCK);
+	struct cache_digest start;
+	uint64_t hash = CACHE_HASH_INIT, first;
+	uint32_t version = G711_KERNEL_VERSION;
+	size_t n;
+	int i;
+
+	n = in_fmt->data_bytes < CACHE_KEY_BLOCK ? (size_t)in_fmt->data_bytes : CACHE_KEY_BLOCK;
+	cache_digest_init(&start);
+	cache_digest_add(&start, buffer, fread(buffer, 1, n, fRead));
+	first = cache_digest_end(&start);
+	free(buffer);
+	if(wav_seek_data(fRead, in_fmt) != 0)
+	{
+		fprintf(msg, "Error while going back to the audio.\n");
+		exit(EXIT_FAILURE);
+	}
+	hash = cache_hash(hash, &first, sizeof(first));
+	hash = cache_hash(hash, &in_fmt->data_bytes, sizeof(in_fmt->data_bytes));
+	hash = cache_hash(hash, &in_fmt->formattag, sizeof(in_fmt->formattag));
+	hash = cache_hash(hash, &in_fmt->nChannels, sizeof(in_fmt->nChannels));
+	hash = cache_hash(hash, &in_fmt->frequency, sizeof(in_fmt->frequency));
+	hash = cache_hash(hash, &in_fmt->bits_per_sample, sizeof(in_fmt->bits_per_sample));
+	hash = cache_hash(hash, &version, sizeof(version));
+	hash = cache_hash_string(hash, argv[2]);
+	for(i = 4; i < argc; i++)
+	{
+		if(wcscmp(argv[i], L"-cache") == 0 || wcscmp(argv[i], L"-cachesize") == 0)
+			i++;
+		else
+			hash = cache_hash_string(hash, argv[i]);
+	}
+	return hash;
+}
+/** @brief the cache digest of the audio, whole frames of frame_bytes
+as the conversion reads them. Reads the input to the end and then
+goes back to the audio, so fRead must be able to seek. */
+uint64_t audio_digest(FILE *fRead, const struct wav_format * in_fmt, int frame_bytes)
+{
+	unsigned char *buffer = (unsigned char *)allocate_buffer(EDIT_BLOCK);
+	struct cache_digest d;
+	uint64_t left = in_fmt->data_bytes, content;
+	size_t n, got;
+
+	if(left != WAV_SIZE_UNKNOWN)
+		left /= frame_bytes;
+	cache_digest_init(&d);
+	while(left > 0)
+	{
+		n = EDIT_BLOCK / frame_bytes;
+		if(left < n)
+			n = (size_t)left;
+		got = fread(buffer, frame_bytes, n, fRead);
+		cache_digest_add(&d, buffer, got * frame_bytes);
+		if(got != n)
+			break;
+		if(left != WAV_SIZE_UNKNOWN)
+			left -= got;
+	}
+	free(buffer);
+	content = cache_digest_end(&d);
+	if(wav_seek_data(fRead, in_fmt) != 0)
+	{
+		fprintf(msg, "Error while going back to the audio.\n");
+		exit(EXIT_FAILURE);
+	}
+	return content;
+}
 /** @brief the main function, takes Unicode arguments. 
 Thank you, Windows, for the complication. */
 int wmain(int argc, wchar_t *argv[])
@@ -246,174 +1139,247 @@ int wmain(int argc, wchar_t *argv[])
     char    *bufferRead, *bufferWrite;
     long    bufferReadSize, bufferWriteSize;
     size_t  readed;
-	struct PCMheader pcm_header;
-	struct G711header g711_header;
-	uint32_t bytes_in_data = 0;
+	struct wav_format in_fmt, out_fmt;
+	struct options opts;
+	struct pipeline pipe;
+	enum sample_format in, out;
+	uint64_t frames, total_read = 0, total_written = 0;
+	int block, max_block = STREAM_BLOCK;
+	int to_stdout;
+	uint64_t key = 0, content = 0;
+	struct cache_digest digest;
+	int cached, digested = 0;
 
 
-    if(argc != 4)
+	/* with the audio on stdout everything else goes to stderr, even
+	the complaint about a bad command line */
+	to_stdout = argc >= 4 && wcscmp(argv[3], L"-") == 0;
+	msg = to_stdout ? stderr : stdout;
+	if(to_stdout)
+		wav_messages(stderr);
+    if(argc < 4 || parse_options(argc, argv, &opts) != 0)
     {
-        printf("Incorrect parameter length.\n");
+        fprintf(msg, "Incorrect parameter length.\n");
         print_usage(argv[0]);
         exit(EXIT_FAILURE);
     }
+	if(to_stdout)
+	{
+		if(opts.autotune)
+		{
+			fprintf(msg, "-autotune reports on stdout, it can not be used with output to -.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
 
-    /* open an existing file for reading */
-	printf("opening %s\n",argv[1]);
-    fRead = _wfopen(argv[1],L"rb");
+	if(wcscmp(argv[1], L"-") == 0)
+	{
+		fRead = stdin;
+		set_binary(stdin);
+		max_block = PIPE_BLOCK;
+	}
+	else
+	{
+		/* open an existing file for reading */
+		fprintf(msg, "opening %s\n",argv[1]);
+		fRead = _wfopen(argv[1],L"rb");
+	}
 
     /* quit if the file does not exist */
     if( fRead == NULL )
     {
-       printf("Error while opening read file.\n");
+       fprintf(msg, "Error while opening read file.\n");
        exit(EXIT_FAILURE);
     }
-	/* open a file for writing */
-    fWrite = _wfopen(argv[3], L"wb");
+	/* packed files are not wav */
+	if(wcscmp(argv[2], L"pack_g711") == 0)
+		return unpack_file(fRead, argv[3], &opts);
+	if(wav_read_header(fRead, &in_fmt) != 0)
+	{
+		fprintf(msg, "Error while reading the header.\n");
+		exit(EXIT_FAILURE);
+	}
+	wav_print(&in_fmt);
+	if(wcscmp(argv[2], L"g711_pack") == 0)
+		return pack_file(fRead, &in_fmt, argv[3], &opts);
+	if(wcscmp(argv[2], L"g711_concat") == 0 || wcscmp(argv[2], L"g711_trim") == 0 ||
+		wcscmp(argv[2], L"g711_split") == 0)
+	{
+		require_g711(&in_fmt);
+		if(wcscmp(argv[2], L"g711_concat") == 0)
+			return concat_files(fRead, &in_fmt, argv[3], &opts);
+		if(wcscmp(argv[2], L"g711_trim") == 0)
+			return trim_file(fRead, &in_fmt, argv[3], &opts);
+		return split_file(fRead, &in_fmt, argv[3], &opts);
+	}
+	in = wav_sample_format(&in_fmt);
 
-    /* quit if the file can not be opened */
-    if( fWrite == NULL )
-    {
-       printf("Error while opening the write file.\n");
-       exit(EXIT_FAILURE);
-    }
     /* Conversions */
-
-    if (strcmp(argv[2], L"g711_pcm") == 0) 
+	out_fmt = in_fmt;
+    if (wcscmp(argv[2], L"g711_pcm") == 0 || wcscmp(argv[2], L"g711_float") == 0 ||
+		wcscmp(argv[2], L"g711_g711") == 0) 
     {
-		// Read in header
-		fread(&g711_header,1,sizeof(g711_header),fRead);
-		/* Get file size */
-		printG711header(g711_header);
-		bufferReadSize = g711_header.FileSize - sizeof(g711_header);
-		printf("bufferReadSize: %d\n",bufferReadSize);
-		/* grab sufficient memory for the buffer to hold the audio */
-		bufferRead = allocate_buffer(bufferReadSize);
-		/* copy all the data into the buffer */
-		readed = fread(bufferRead, sizeof(char), bufferReadSize, fRead);
-		printf("bytes read in: %d\n",readed);
-		if (readed != bufferReadSize)
-		{
-			printf("Incorrect bytes read in\n");
-			exit(EXIT_FAILURE);
-		}
-		fclose(fRead);
-		initPCMheader(&pcm_header);
-		pcm_header.nChannels = g711_header.nChannels;
-		pcm_header.frequency = g711_header.frequency;
-		pcm_header.bytes_per_second = g711_header.bytes_per_second*2;
-		pcm_header.bytes_in_data = g711_header.FileSize - sizeof(g711_header);
-		pcm_header.bytes_in_data *= 2;
-		pcm_header.FileSize = sizeof(pcm_header)+pcm_header.bytes_in_data;
-		printPCMheader(pcm_header);
-		fwrite (&pcm_header , 1, sizeof(pcm_header), fWrite);
-		if(g711_header.formattag == 7)
-		{
-			printf("Converting mu-law to pcm\n");
-			ulaw_pcm16_tableinit();
-			bufferWriteSize = bufferReadSize * 2;
-			bufferWrite = allocate_buffer(bufferWriteSize);
-			ulaw_to_pcm16(bufferReadSize, bufferRead, bufferWrite);
-
-		}
-		else if(g711_header.formattag == 6)
-		{
-			printf("converting A-law to pcm\n");
-			alaw_pcm16_tableinit();
-			bufferWriteSize = bufferReadSize * 2;
-			bufferWrite = allocate_buffer(bufferWriteSize);
-			alaw_to_pcm16(bufferReadSize, bufferRead, bufferWrite);
-		}
-		else 
-		{
-			printf("Input file is not G711 encoded.\n");
+		if(in != FMT_ALAW && in != FMT_ULAW)
+		{
+			fprintf(msg, "Input file is not G711 encoded.\n");
 			exit(EXIT_FAILURE);
 		}
-		
-        
+		if (wcscmp(argv[2], L"g711_pcm") == 0)
+			out = FMT_PCM16;
+		else if (wcscmp(argv[2], L"g711_float") == 0)
+			out = FMT_FLOAT32;
+		else
+			out = in;
     } 
-    else if (strcmp(argv[2], L"pcm_alaw") == 0)
+    else if (wcscmp(argv[2], L"pcm_alaw") == 0 || wcscmp(argv[2], L"pcm_ulaw") == 0 ||
+		wcscmp(argv[2], L"pcm_pcm") == 0)
     {
-		// Read in header
-		fread(&pcm_header,1,sizeof(pcm_header),fRead);
-		// Print bytes of data field
-		printPCMheader(pcm_header);
-		/* Get file size */
-		bufferReadSize = pcm_header.bytes_in_data;
-		/* grab sufficient memory for the buffer to hold the audio */
-		bufferRead = allocate_buffer(bufferReadSize);
-		/* copy all the text into the buffer */
-		readed = fread(bufferRead, sizeof(char), bufferReadSize, fRead);
-		if (readed != bufferReadSize)
-		{
-			printf("Incorrect bytes readed\n");
-			exit(EXIT_FAILURE);
-		}
-		fclose(fRead);
-		initG711header(&g711_header);
-		g711_header.formattag = 6;
-		g711_header.nChannels = pcm_header.nChannels;
-		g711_header.frequency = pcm_header.frequency;
-		g711_header.bytes_per_second = pcm_header.bytes_per_second/pcm_header.bytes_by_capture;
-		g711_header.sampleLengthLSB = (pcm_header.bytes_in_data/2)&0x0000FFFF;
-		g711_header.sampleLengthMSB = ((pcm_header.bytes_in_data/2)>>16)&0x0000FFFF;
-		g711_header.dataLengthLSB = g711_header.sampleLengthLSB;
-		g711_header.dataLengthMSB = g711_header.sampleLengthMSB;
-		g711_header.FileSize=sizeof(g711_header)+(pcm_header.bytes_in_data/2);
-		printG711header(g711_header);
-		fwrite (&g711_header , 1, sizeof(g711_header), fWrite);
-        pcm16_alaw_tableinit();
-        bufferWriteSize = bufferReadSize / 2;
-        bufferWrite = allocate_buffer(bufferWriteSize);
-        pcm16_to_alaw(bufferReadSize, bufferRead, bufferWrite);
-    }
-    else if (strcmp(argv[2], L"pcm_ulaw") == 0)
-    {
-		// Read in header
-		fread(&pcm_header,1,sizeof(pcm_header),fRead);
-		// Print bytes of data field
-		printPCMheader(pcm_header);
-		/* Get file size */
-		bufferReadSize = pcm_header.bytes_in_data;
-		/* grab sufficient memory for the buffer to hold the audio */
-		bufferRead = allocate_buffer(bufferReadSize);
-		/* copy all the text into the buffer */
-		readed = fread(bufferRead, sizeof(char), bufferReadSize, fRead);
-		if (readed != bufferReadSize)
-		{
-			printf("Incorrect bytes readed\n");
+		if(in != FMT_PCM16 && in != FMT_PCM24 && in != FMT_FLOAT32)
+		{
+			fprintf(msg, "Unsupported PCM format.\n");
 			exit(EXIT_FAILURE);
 		}
-		fclose(fRead);initG711header(&g711_header);
-		g711_header.formattag = 7;
-		g711_header.nChannels = pcm_header.nChannels;
-		g711_header.frequency = pcm_header.frequency;
-		g711_header.bytes_per_second = pcm_header.bytes_per_second/pcm_header.bytes_by_capture;
-		g711_header.sampleLengthLSB = (pcm_header.bytes_in_data/2)&0x0000FFFF;
-		g711_header.sampleLengthMSB = ((pcm_header.bytes_in_data/2)>>16)&0x0000FFFF;
-		g711_header.dataLengthLSB = g711_header.sampleLengthLSB;
-		g711_header.dataLengthMSB = g711_header.sampleLengthMSB;
-		g711_header.FileSize=sizeof(g711_header)+(pcm_header.bytes_in_data/2);
-		printG711header(g711_header);
-		fwrite (&g711_header , 1, sizeof(g711_header), fWrite);initG711header(&g711_header);
-        pcm16_ulaw_tableinit();
-        bufferWriteSize = bufferReadSize / 2;
-        bufferWrite = allocate_buffer(bufferWriteSize);
-        pcm16_to_ulaw(bufferReadSize, bufferRead, bufferWrite);
+		if (wcscmp(argv[2], L"pcm_alaw") == 0)
+			out = FMT_ALAW;
+		else if (wcscmp(argv[2], L"pcm_ulaw") == 0)
+			out = FMT_ULAW;
+		else
+			out = in;
     }
     else
     {
-        printf("Incorrect parameter.\n");
+        fprintf(msg, "Incorrect parameter.\n");
         print_usage(argv[0]);
         exit(EXIT_FAILURE);
     }
+	if(opts.channel > in_fmt.nChannels)
+	{
+		fprintf(msg, "Input file has no channel %d.\n", opts.channel);
+		exit(EXIT_FAILURE);
+	}
+
+	/* a repeat of a cached conversion is just a copy. The audio is only
+	read ahead when an entry starts the same, otherwise its digest is
+	taken on the way through */
+	cached = opts.cache != NULL && fRead != stdin && !to_stdout;
+	if(cached)
+	{
+		key = conversion_key(fRead, &in_fmt, argc, argv);
+		if(cache_lookup(opts.cache, key) == 0)
+		{
+			content = audio_digest(fRead, &in_fmt, format_size[in] * in_fmt.nChannels);
+			digested = 1;
+			if(cache_fetch(opts.cache, key, content, argv[3]) == 0)
+			{
+				fprintf(msg, "Copied from the cache.\n");
+				fclose(fRead);
+				return 0;
+			}
+		}
+		cache_digest_init(&digest);
+	}
+
+	/* G711 is only defined at 8kHz, PCM keeps its rate */
+	if(opts.rate)
+		out_fmt.frequency = opts.rate;
+	else if(out == FMT_ALAW || out == FMT_ULAW)
+		out_fmt.frequency = G711_RATE;
+	if(out_fmt.frequency != in_fmt.frequency)
+		fprintf(msg, "resampling %d -> %d samples/second\n",in_fmt.frequency,out_fmt.frequency);
+	pcm24_dither(opts.dither);
+	if(opts.autotune)
+	{
+		g711_autotune(STREAM_BLOCK * in_fmt.nChannels);
+		g711_print_kernels();
+	}
+	if(setup_pipeline(&pipe, in, out, in_fmt.nChannels, opts.channel, in_fmt.frequency, out_fmt.frequency) != 0)
+	{
+		fprintf(msg, "Unsupported conversion.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	out_fmt.container = opts.container;
+	out_fmt.nChannels = opts.channel ? 1 : in_fmt.nChannels;
+	out_fmt.bits_per_sample = format_size[out]*8;
+	out_fmt.formattag = out == FMT_ALAW ? WAVE_FORMAT_ALAW : out == FMT_ULAW ? WAVE_FORMAT_MULAW :
+		out == FMT_FLOAT32 ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+	/* a stream of unknown length is read until it ends */
+	if(in_fmt.data_bytes == WAV_SIZE_UNKNOWN)
+	{
+		frames = WAV_SIZE_UNKNOWN;
+		out_fmt.data_bytes = WAV_SIZE_UNKNOWN;
+	}
+	else
+	{
+		frames = in_fmt.data_bytes / (pipe.in_size * in_fmt.nChannels);
+		out_fmt.data_bytes = pipeline_frames(&pipe, frames) * out_fmt.nChannels * pipe.out_size;
+	}
+
+	fWrite = open_output(argv[3]);
+	/* the header goes first and the audio streams through behind it */
+	if(!opts.raw)
+		write_header(fWrite, &out_fmt, !to_stdout);
+
+	bufferReadSize = max_block * pipe.in_size * in_fmt.nChannels;
+	bufferRead = allocate_buffer(bufferReadSize);
+	bufferWrite = allocate_buffer(pipeline_block_bytes(&pipe));
+	while(frames > 0)
+	{
+		block = frames > max_block ? max_block : (int)frames;
+		readed = fread(bufferRead, pipe.in_size * in_fmt.nChannels, block, fRead);
+		if (readed != block)
+		{
+			if (in_fmt.data_bytes != WAV_SIZE_UNKNOWN || ferror(fRead))
+			{
+				fprintf(msg, "Incorrect bytes read in\n");
+				exit(EXIT_FAILURE);
+			}
+			/* the end of a stream of unknown length */
+			block = (int)readed;
+			frames = block;
+		}
+		if(cached && !digested)
+			cache_digest_add(&digest, bufferRead, (size_t)block * pipe.in_size * in_fmt.nChannels);
+		bufferWriteSize = run_pipeline(&pipe, bufferRead, block, bufferWrite);
+		if (fwrite (bufferWrite , sizeof(char), bufferWriteSize, fWrite) != bufferWriteSize)
+		{
+			fprintf(msg, "Error while writing the output.\n");
+			exit(EXIT_FAILURE);
+		}
+		/* hand each block on as soon as it is converted */
+		if (fRead == stdin)
+			fflush(fWrite);
+		total_read += (uint64_t)block * pipe.in_size * in_fmt.nChannels;
+		total_written += bufferWriteSize;
+		frames -= block;
+	}
+	/* the last half filter of a resampled stream */
+	bufferWriteSize = flush_pipeline(&pipe, bufferWrite);
+	if (fwrite (bufferWrite , sizeof(char), bufferWriteSize, fWrite) != bufferWriteSize)
+	{
+		fprintf(msg, "Error while writing the output.\n");
+		exit(EXIT_FAILURE);
+	}
+	total_written += bufferWriteSize;
+
+	/* now the length is known, fill it in if the output can seek back */
+	if(out_fmt.data_bytes == WAV_SIZE_UNKNOWN && !opts.raw && !to_stdout)
+		patch_header(fWrite, &out_fmt, total_written);
+	if(fRead != stdin)
+		fclose(fRead);
+	if(fWrite != stdout)
+		fclose (fWrite);
+	else
+		fflush(fWrite);
 
-    printf("Bytes read: %ld, Buffer Write: %ld\n", bufferReadSize, bufferWriteSize);
-    /* copy all the buffer into the file */
-    fwrite (bufferWrite , sizeof(char), bufferWriteSize, fWrite);
-    fclose (fWrite);
+    fprintf(msg, "Bytes read: %.0f, Bytes written: %.0f\n", (double)total_read, (double)total_written);
+	if(cached && !digested)
+		content = cache_digest_end(&digest);
+	if(cached && cache_store(opts.cache, key, content, argv[3], opts.cache_bytes) != 0)
+		fprintf(msg, "The output could not be added to the cache.\n");
 
-    /* free the memory we used for the buffer */
+    /* free the memory we used for the buffers */
+	free_pipeline(&pipe);
     free(bufferWrite);
     free(bufferRead);
 
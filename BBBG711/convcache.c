@@ -0,0 +1,363 @@
+/** @file convcache.c
+
+	@brief An on-disk cache of finished conversions.
+
+	Windows CE has no hard links and no reflinks, so both storing and
+	fetching an entry is a CopyFile. That still skips reading,
+	converting and resampling the input.
+*/
+#include "stdafx.h"
+#include "convcache.h"
+
+/** @brief the FNV-1a multiplier */
+#define CACHE_HASH_PRIME 0x100000001b3ULL
+/** @brief multipliers of the two halves of the audio digest */
+#define DIGEST_PRIME_LO 0x85EBCA77u
+#define DIGEST_PRIME_HI 0x9E3779B1u
+/** @brief extension of a finished entry */
+#define CACHE_ENTRY L".cc"
+/** @brief extension of an entry still being copied in */
+#define CACHE_TEMP L".tmp"
+
+/** @brief one entry found while evicting */
+struct cache_entry {
+	/** @brief when the entry was stored or last hit */
+	FILETIME time;
+	/** @brief size in bytes */
+	uint64_t size;
+	/** @brief file name within the cache directory */
+	wchar_t name[MAX_PATH];
+};
+
+/** @brief adds bytes of data to an FNV-1a hash */
+uint64_t cache_hash(uint64_t hash, const void *data, size_t bytes)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	size_t i;
+
+	for (i = 0; i < bytes; i++)
+	{
+		hash ^= p[i];
+		hash *= CACHE_HASH_PRIME;
+	}
+	return hash;
+}
+
+/** @brief rotates w left by bits */
+#define ROTL32(w, bits) (((w) << (bits)) | ((w) >> (32 - (bits))))
+
+/** @brief adds one word to both halves of a digest */
+static void digest_word(struct cache_digest *d, uint32_t w)
+{
+	d->lo = ROTL32(d->lo ^ w, 15) * DIGEST_PRIME_LO;
+	d->hi = ROTL32(d->hi + w, 13) * DIGEST_PRIME_HI;
+}
+
+/** @brief spreads every bit of h over the others */
+static uint32_t digest_mix(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+	return h;
+}
+
+/** @brief starts a digest */
+void cache_digest_init(struct cache_digest *d)
+{
+	memset(d, 0, sizeof(*d));
+	d->lo = 0x2545F491u;
+	d->hi = 0x6C8E9CF5u;
+}
+
+/** @brief adds bytes of audio to a digest. The result does not depend
+on how the audio is cut into calls. Words are loaded whole when
+aligned, which matches the byte order of the others on the little
+endian processors Windows runs on */
+void cache_digest_add(struct cache_digest *d, const void *data, size_t bytes)
+{
+	const unsigned char *p = (const unsigned char *)data;
+
+	d->bytes += bytes;
+	/* finish the word the last call started */
+	while (d->carried > 0 && bytes > 0)
+	{
+		d->carry |= (uint32_t)*p++ << (8 * d->carried);
+		bytes--;
+		if (++d->carried == 4)
+		{
+			digest_word(d, d->carry);
+			d->carry = 0;
+			d->carried = 0;
+		}
+	}
+	if (((size_t)p & 3) == 0)
+	{
+		for (; bytes >= 4; p += 4, bytes -= 4)
+			digest_word(d, *(const uint32_t *)p);
+	}
+	else
+	{
+		for (; bytes >= 4; p += 4, bytes -= 4)
+			digest_word(d, (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+				((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+	}
+	for (; bytes > 0; bytes--)
+		d->carry |= (uint32_t)*p++ << (8 * d->carried++);
+}
+
+/** @brief the 64 bit digest of everything added */
+uint64_t cache_digest_end(struct cache_digest *d)
+{
+	uint32_t a, b;
+
+	if (d->carried > 0)
+		digest_word(d, d->carry);
+	digest_word(d, (uint32_t)d->bytes);
+	digest_word(d, (uint32_t)(d->bytes >> 32));
+	a = digest_mix(d->lo ^ ROTL32(d->hi, 16));
+	b = digest_mix(d->hi + a);
+	return ((uint64_t)b << 32) | a;
+}
+
+/** @brief adds a string and its terminator to an FNV-1a hash, two
+bytes a character whatever the size of wchar_t */
+uint64_t cache_hash_string(uint64_t hash, const wchar_t *s)
+{
+	unsigned char c[2];
+
+	do
+	{
+		c[0] = (unsigned char)(*s & 0xFF);
+		c[1] = (unsigned char)((*s >> 8) & 0xFF);
+		hash = cache_hash(hash, c, 2);
+	} while (*s++ != 0);
+	return hash;
+}
+
+/** @brief builds dir\\name into path. returns 0 on success */
+static int cache_path(const wchar_t *dir, const wchar_t *name, wchar_t *path)
+{
+	size_t n = wcslen(dir);
+
+	if (n + wcslen(name) + 2 > MAX_PATH)
+		return -1;
+	wcscpy(path, dir);
+	if (n > 0 && path[n - 1] != L'\\' && path[n - 1] != L'/')
+		wcscat(path, L"\\");
+	wcscat(path, name);
+	return 0;
+}
+
+/** @brief writes bits of u as hex digits at name. returns the
+number of digits */
+static int put_hex(wchar_t *name, uint64_t u, int bits)
+{
+	static const wchar_t hex[] = L"0123456789abcdef";
+	int i, n = 0;
+
+	for (i = bits - 4; i >= 0; i -= 4)
+		name[n++] = hex[(u >> i) & 0xF];
+	return n;
+}
+
+/** @brief the file name of the entry for key and content, with suffix
+on the end. A number other than 0 goes in after them, all as hex
+digits */
+static int entry_path(const wchar_t *dir, uint64_t key, uint64_t content,
+	uint32_t number, const wchar_t *suffix, wchar_t *path)
+{
+	wchar_t name[64];
+	int n;
+
+	n = put_hex(name, key, 64);
+	name[n++] = L'.';
+	n += put_hex(name + n, content, 64);
+	if (number)
+	{
+		name[n++] = L'.';
+		n += put_hex(name + n, number, 32);
+	}
+	name[n] = 0;
+	wcscat(name, suffix);
+	return cache_path(dir, name, path);
+}
+
+/** @brief sets the time of an entry to now, so eviction sees it as
+recently used. CE does not keep last access times, so the last
+write time stands in for it. returns 0 if the entry exists */
+static int touch(const wchar_t *path)
+{
+	HANDLE h;
+	SYSTEMTIME now;
+	FILETIME ft;
+
+	h = CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return -1;
+	GetSystemTime(&now);
+	SystemTimeToFileTime(&now, &ft);
+	SetFileTime(h, NULL, NULL, &ft);
+	CloseHandle(h);
+	return 0;
+}
+
+/** @brief when this process first used the cache, which stands in
+for the start of the run */
+static const FILETIME *run_start(void)
+{
+	static FILETIME started;
+	static int known;
+	SYSTEMTIME now;
+
+	if (!known)
+	{
+		GetSystemTime(&now);
+		SystemTimeToFileTime(&now, &started);
+		known = 1;
+	}
+	return &started;
+}
+
+/** @brief deletes the temporary files that were created before this
+run, left by a process that died between copying and moving. CopyFile
+keeps the last write time of its source, so the creation time tells
+how old the copy is */
+static void sweep_temps(const wchar_t *dir)
+{
+	WIN32_FIND_DATAW fd;
+	HANDLE find;
+	wchar_t path[MAX_PATH];
+
+	if (cache_path(dir, L"*" CACHE_TEMP, path) != 0)
+		return;
+	find = FindFirstFileW(path, &fd);
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		if (CompareFileTime(&fd.ftCreationTime, run_start()) < 0 &&
+			cache_path(dir, fd.cFileName, path) == 0)
+			DeleteFileW(path);
+	} while (FindNextFileW(find, &fd));
+	FindClose(find);
+}
+
+/** @brief orders entries oldest first */
+static int older(const void *a, const void *b)
+{
+	return CompareFileTime(&((const struct cache_entry *)a)->time,
+		&((const struct cache_entry *)b)->time);
+}
+
+/** @brief deletes stale temporary files, then the least recently used
+entries until dir holds no more than max_bytes. An entry another
+process is copying can not be deleted and is left for next time. */
+static void evict(const wchar_t *dir, uint64_t max_bytes)
+{
+	WIN32_FIND_DATAW fd;
+	HANDLE find;
+	struct cache_entry *entries = NULL, *grown;
+	int count = 0, room = 0, i;
+	uint64_t total = 0;
+	wchar_t path[MAX_PATH];
+
+	sweep_temps(dir);
+	if (cache_path(dir, L"*" CACHE_ENTRY, path) != 0)
+		return;
+	find = FindFirstFileW(path, &fd);
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		if (count == room)
+		{
+			room = room ? room * 2 : 64;
+			grown = (struct cache_entry *)realloc(entries, room * sizeof(struct cache_entry));
+			if (grown == NULL)
+				break;
+			entries = grown;
+		}
+		entries[count].time = fd.ftLastWriteTime;
+		entries[count].size = ((uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+		wcscpy(entries[count].name, fd.cFileName);
+		total += entries[count].size;
+		count++;
+	} while (FindNextFileW(find, &fd));
+	FindClose(find);
+
+	if (total > max_bytes)
+	{
+		qsort(entries, count, sizeof(struct cache_entry), older);
+		for (i = 0; i < count && total > max_bytes; i++)
+		{
+			if (cache_path(dir, entries[i].name, path) == 0 && DeleteFileW(path))
+				total -= entries[i].size;
+		}
+	}
+	free(entries);
+}
+
+/** @brief tells whether any entry is stored under key, whatever its
+content. returns 0 if one is */
+int cache_lookup(const wchar_t *dir, uint64_t key)
+{
+	WIN32_FIND_DATAW fd;
+	HANDLE find;
+	wchar_t name[32], path[MAX_PATH];
+	int n;
+
+	run_start();
+	n = put_hex(name, key, 64);
+	name[n] = 0;
+	wcscat(name, L".*" CACHE_ENTRY);
+	if (cache_path(dir, name, path) != 0)
+		return -1;
+	find = FindFirstFileW(path, &fd);
+	if (find == INVALID_HANDLE_VALUE)
+		return -1;
+	FindClose(find);
+	return 0;
+}
+
+/** @brief copies the entry for key and content to out_name. returns 0
+on a hit */
+int cache_fetch(const wchar_t *dir, uint64_t key, uint64_t content, const wchar_t *out_name)
+{
+	wchar_t path[MAX_PATH];
+
+	run_start();
+	if (entry_path(dir, key, content, 0, CACHE_ENTRY, path) != 0 || touch(path) != 0)
+		return -1;
+	/* it may still have been evicted since */
+	return CopyFileW(path, out_name, FALSE) ? 0 : -1;
+}
+
+/** @brief stores out_name as the entry for key and content, then
+evicts down to max_bytes. returns 0 on success, which includes finding
+the entry already stored by another process */
+int cache_store(const wchar_t *dir, uint64_t key, uint64_t content, const wchar_t *out_name,
+	uint64_t max_bytes)
+{
+	wchar_t path[MAX_PATH], temp[MAX_PATH];
+
+	run_start();
+	if (entry_path(dir, key, content, 0, CACHE_ENTRY, path) != 0 ||
+		entry_path(dir, key, content, (uint32_t)GetCurrentProcessId(), CACHE_TEMP, temp) != 0)
+		return -1;
+	CreateDirectoryW(dir, NULL);
+	if (!CopyFileW(out_name, temp, FALSE))
+		return -1;
+	/* when another process stored the same key first, keep theirs */
+	if (!MoveFileW(temp, path))
+	{
+		DeleteFileW(temp);
+		if (GetFileAttributesW(path) == INVALID_FILE_ATTRIBUTES)
+			return -1;
+	}
+	evict(dir, max_bytes);
+	return 0;
+}
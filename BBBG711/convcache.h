@@ -0,0 +1,58 @@
+/** @file convcache.h
+
+	@brief An on-disk cache of finished conversions.
+
+	An IVR platform converts the same prompts again and again. An entry
+	is found by a key and a content digest. The key is an FNV-1a hash
+	of the input format and length, the conversion and its options,
+	G711_KERNEL_VERSION and the first block of the audio, so it costs
+	no more than reading that block. The digest covers all of the
+	audio, a 32 bit word at a time, and is taken while converting.
+	Only when some entry already has the key is the input read through
+	for its digest first, and if an entry has both, a repeat conversion
+	copies the stored file instead of converting.
+
+	Entries are written to a temporary name and moved into place, so
+	another process never sees half of one. Temporary files made
+	before the run, by a process that died, are deleted when evicting.
+	A hit refreshes the time of the entry, and once the directory holds
+	more than its limit the least recently used entries are deleted.
+*/
+#ifndef CONVCACHE_H
+#define CONVCACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief the FNV-1a starting value */
+#define CACHE_HASH_INIT 0xcbf29ce484222325ULL
+
+/** @brief a running digest of audio, two 32 bit halves taken a word
+at a time, so there is no 64 bit multiply on the way */
+struct cache_digest {
+	/** @brief the two halves */
+	uint32_t lo, hi;
+	/** @brief bytes not yet making up a word */
+	uint32_t carry;
+	/** @brief how many there are */
+	int carried;
+	/** @brief bytes added */
+	uint64_t bytes;
+};
+
+uint64_t cache_hash(uint64_t hash, const void *data, size_t bytes);
+uint64_t cache_hash_string(uint64_t hash, const wchar_t *s);
+void cache_digest_init(struct cache_digest *d);
+void cache_digest_add(struct cache_digest *d, const void *data, size_t bytes);
+uint64_t cache_digest_end(struct cache_digest *d);
+int  cache_lookup(const wchar_t *dir, uint64_t key);
+int  cache_fetch(const wchar_t *dir, uint64_t key, uint64_t content, const wchar_t *out_name);
+int  cache_store(const wchar_t *dir, uint64_t key, uint64_t content, const wchar_t *out_name,
+	uint64_t max_bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONVCACHE_H */
@@ -0,0 +1,132 @@
+/** @file g711_batch.c
+
+	@brief Converting many independent frames in one call.
+
+	The kernels are the ones bound by g711_dispatch.c, so the tables
+	must have been built (the *_tableinit functions or g711_autotune)
+	before the first batch.
+*/
+#include "stdafx.h"
+#include "g711_batch.h"
+
+/** @brief the signature every kernel shares */
+typedef void (*batch_kernel)(int, const char *, char *);
+
+/** @brief runs every frame of one law through kernel. Frames whose
+source and destination both continue where the previous frame ended
+are merged into one call. in_size and out_size are bytes per sample. */
+static void run_law(const struct g711_frame *frames, int count, int law,
+	batch_kernel kernel, int in_size, int out_size)
+{
+	const char *src = NULL;
+	char *dst = NULL;
+	int samples = 0;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (frames[i].law != law || frames[i].samples <= 0)
+			continue;
+		if (samples > 0 && frames[i].src == src + samples * in_size &&
+			frames[i].dst == dst + samples * out_size)
+		{
+			samples += frames[i].samples;
+			continue;
+		}
+		if (samples > 0)
+			kernel(samples * in_size, src, dst);
+		src = frames[i].src;
+		dst = frames[i].dst;
+		samples = frames[i].samples;
+	}
+	if (samples > 0)
+		kernel(samples * in_size, src, dst);
+}
+
+/** @brief number of frames run_law() will not touch: a law that is
+neither G711_ALAW nor G711_ULAW, or fewer than 0 samples */
+static int rejected(const struct g711_frame *frames, int count)
+{
+	int i, bad = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		if ((frames[i].law != G711_ALAW && frames[i].law != G711_ULAW) || frames[i].samples < 0)
+			bad++;
+	}
+	return bad;
+}
+
+/** @brief encodes count frames of pcm16, each to its own law. returns
+the number of frames left unconverted because they were invalid, 
+whose dst is not written */
+int g711_encode_batch(const struct g711_frame *frames, int count)
+{
+	run_law(frames, count, G711_ALAW, pcm16_to_alaw, 2, 1);
+	run_law(frames, count, G711_ULAW, pcm16_to_ulaw, 2, 1);
+	return rejected(frames, count);
+}
+
+/** @brief decodes count frames of G711, each from its own law. 
+returns the number of frames left unconverted, as g711_encode_batch() */
+int g711_decode_batch(const struct g711_frame *frames, int count)
+{
+	run_law(frames, count, G711_ALAW, alaw_to_pcm16, 1, 2);
+	run_law(frames, count, G711_ULAW, ulaw_to_pcm16, 1, 2);
+	return rejected(frames, count);
+}
+
+/** @brief encodes a channel major buffer, pcm[channel * samples + i],
+where laws[channel] picks the law of each channel. returns the number
+of channels left unconverted because their law is invalid */
+int g711_encode_channels(const short *pcm, int channels, int samples,
+	const unsigned char *laws, unsigned char *g711)
+{
+	int c;
+	int first = 0;
+	int bad = 0;
+
+	/* neighbouring channels with the same law are one run of memory */
+	for (c = 1; c <= channels; c++)
+	{
+		if (c < channels && laws[c] == laws[first])
+			continue;
+		if (laws[first] == G711_ALAW)
+			pcm16_to_alaw((c - first) * samples * 2, (const char *)(pcm + first * samples),
+				(char *)(g711 + first * samples));
+		else if (laws[first] == G711_ULAW)
+			pcm16_to_ulaw((c - first) * samples * 2, (const char *)(pcm + first * samples),
+				(char *)(g711 + first * samples));
+		else
+			bad += c - first;
+		first = c;
+	}
+	return bad;
+}
+
+/** @brief decodes a channel major buffer, g711[channel * samples + i],
+where laws[channel] picks the law of each channel. returns the number
+of channels left unconverted because their law is invalid */
+int g711_decode_channels(const unsigned char *g711, int channels, int samples,
+	const unsigned char *laws, short *pcm)
+{
+	int c;
+	int first = 0;
+	int bad = 0;
+
+	for (c = 1; c <= channels; c++)
+	{
+		if (c < channels && laws[c] == laws[first])
+			continue;
+		if (laws[first] == G711_ALAW)
+			alaw_to_pcm16((c - first) * samples, (const char *)(g711 + first * samples),
+				(char *)(pcm + first * samples));
+		else if (laws[first] == G711_ULAW)
+			ulaw_to_pcm16((c - first) * samples, (const char *)(g711 + first * samples),
+				(char *)(pcm + first * samples));
+		else
+			bad += c - first;
+		first = c;
+	}
+	return bad;
+}
@@ -0,0 +1,48 @@
+/** @file g711_batch.h
+
+	@brief Converting many independent frames in one call.
+
+	A media gateway has thousands of calls, each delivering one short
+	frame (160 samples = 20ms) per tick. Converting them one call at a
+	time keeps switching between the A-law and u-law tables and pays
+	the call overhead per frame. The batch functions take every frame
+	of a tick at once, run all the A-law frames and then all the u-law
+	frames, and merge frames that sit back to back in memory into one
+	kernel call.
+*/
+#ifndef G711_BATCH_H
+#define G711_BATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief frame uses A-law */
+#define G711_ALAW 0
+/** @brief frame uses u-law */
+#define G711_ULAW 1
+
+/** @brief one frame of one stream */
+struct g711_frame {
+	/** @brief G711_ALAW or G711_ULAW */
+	int law;
+	/** @brief number of samples in the frame */
+	int samples;
+	/** @brief pcm16 samples to encode, or G711 bytes to decode */
+	const char *src;
+	/** @brief where the converted samples go */
+	char *dst;
+};
+
+int g711_encode_batch(const struct g711_frame *frames, int count);
+int g711_decode_batch(const struct g711_frame *frames, int count);
+int g711_encode_channels(const short *pcm, int channels, int samples,
+	const unsigned char *laws, unsigned char *g711);
+int g711_decode_channels(const unsigned char *g711, int channels, int samples,
+	const unsigned char *laws, short *pcm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* G711_BATCH_H */
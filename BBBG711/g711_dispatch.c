@@ -0,0 +1,286 @@
+/** @file g711_dispatch.c
+
+	@brief Runtime selection of the G.711 kernels.
+
+	Which kernel is fastest depends on the processor and its caches
+	more than on the instruction set, so it is decided on the machine,
+	not at build time. A kernel that needs a CPU feature is only a
+	candidate when g711_cpu_features() reports it. The ARMv4I build
+	has only the scalar kernels; an x86 build of the same sources adds
+	the SSE2 encoders. A feature gets a CPU_* bit once a kernel needs
+	it.
+*/
+#include "stdafx.h"
+#include "g711.h"
+#include "g711_dispatch.h"
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#endif
+
+/** @brief the signature every kernel shares */
+typedef void (*g711_kernel_fn)(int, const char *, char *);
+
+/** @brief one implementation of a conversion */
+struct g711_kernel {
+	/** @brief short name for the report */
+	const char *name;
+	/** @brief CPU_* bits it needs */
+	unsigned features;
+	/** @brief the kernel */
+	g711_kernel_fn fn;
+};
+
+/** @brief one public entry point and the kernels that may sit behind it */
+struct g711_slot {
+	/** @brief the public name */
+	const char *name;
+	/** @brief 1 for pcm16 -> 8 bit, 0 for 8 bit -> pcm16 */
+	int encode;
+	/** @brief candidates, the reference first */
+	const struct g711_kernel *candidates;
+	/** @brief number of candidates */
+	int count;
+	/** @brief the one currently bound */
+	const struct g711_kernel *bound;
+};
+
+static void pcm16_to_alaw_search(int src_length, const char *src_samples, char *dst_samples)
+{
+	int i;
+	const short *s_samples = (const short *)src_samples;
+
+	for (i = 0; i < src_length / 2; i++)
+		dst_samples[i] = linear2alaw(s_samples[i]);
+}
+
+static void pcm16_to_ulaw_search(int src_length, const char *src_samples, char *dst_samples)
+{
+	int i;
+	const short *s_samples = (const short *)src_samples;
+
+	for (i = 0; i < src_length / 2; i++)
+		dst_samples[i] = linear2ulaw(s_samples[i]);
+}
+
+static void alaw_to_pcm16_search(int src_length, const char *src_samples, char *dst_samples)
+{
+	int i;
+	short *d_samples = (short *)dst_samples;
+
+	for (i = 0; i < src_length; i++)
+		d_samples[i] = alaw2linear((unsigned char)src_samples[i]);
+}
+
+static void ulaw_to_pcm16_search(int src_length, const char *src_samples, char *dst_samples)
+{
+	int i;
+	short *d_samples = (short *)dst_samples;
+
+	for (i = 0; i < src_length; i++)
+		d_samples[i] = ulaw2linear((unsigned char)src_samples[i]);
+}
+
+static const struct g711_kernel alaw_encoders[] = {
+	{ "search", 0, pcm16_to_alaw_search },
+	{ "table", 0, pcm16_to_alaw_table },
+	{ "compact", 0, pcm16_to_alaw_compact }
+#if defined(_M_IX86) || defined(_M_X64)
+	, { "sse2", CPU_SSE2, pcm16_to_alaw_sse2 }
+#endif
+	};
+static const struct g711_kernel ulaw_encoders[] = {
+	{ "search", 0, pcm16_to_ulaw_search },
+	{ "table", 0, pcm16_to_ulaw_table },
+	{ "compact", 0, pcm16_to_ulaw_compact }
+#if defined(_M_IX86) || defined(_M_X64)
+	, { "sse2", CPU_SSE2, pcm16_to_ulaw_sse2 }
+#endif
+	};
+static const struct g711_kernel alaw_decoders[] = {
+	{ "search", 0, alaw_to_pcm16_search },
+	{ "table", 0, alaw_to_pcm16_table },
+	{ "unrolled", 0, alaw_to_pcm16_unrolled } };
+static const struct g711_kernel ulaw_decoders[] = {
+	{ "search", 0, ulaw_to_pcm16_search },
+	{ "table", 0, ulaw_to_pcm16_table },
+	{ "unrolled", 0, ulaw_to_pcm16_unrolled } };
+
+/** @brief number of entries in a candidate list */
+#define CANDIDATES(list) ((int)(sizeof(list) / sizeof(list[0])))
+
+/** @brief the registry, with the table kernels bound by default */
+static struct g711_slot slots[] = {
+	{ "pcm16_to_alaw", 1, alaw_encoders, CANDIDATES(alaw_encoders), alaw_encoders + 1 },
+	{ "pcm16_to_ulaw", 1, ulaw_encoders, CANDIDATES(ulaw_encoders), ulaw_encoders + 1 },
+	{ "alaw_to_pcm16", 0, alaw_decoders, CANDIDATES(alaw_decoders), alaw_decoders + 1 },
+	{ "ulaw_to_pcm16", 0, ulaw_decoders, CANDIDATES(ulaw_decoders), ulaw_decoders + 1 } };
+/** @brief number of entries in slots */
+#define SLOTS (sizeof(slots) / sizeof(slots[0]))
+
+void pcm16_to_alaw(int src_length, const char *src_samples, char *dst_samples)
+{
+	slots[0].bound->fn(src_length, src_samples, dst_samples);
+}
+
+void pcm16_to_ulaw(int src_length, const char *src_samples, char *dst_samples)
+{
+	slots[1].bound->fn(src_length, src_samples, dst_samples);
+}
+
+void alaw_to_pcm16(int src_length, const char *src_samples, char *dst_samples)
+{
+	slots[2].bound->fn(src_length, src_samples, dst_samples);
+}
+
+void ulaw_to_pcm16(int src_length, const char *src_samples, char *dst_samples)
+{
+	slots[3].bound->fn(src_length, src_samples, dst_samples);
+}
+
+/** @brief CPU_* bits for the processor we are running on */
+unsigned g711_cpu_features()
+{
+	unsigned features = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+	int info[4];
+
+	__cpuid(info, 1);
+	if (info[3] & (1 << 26))
+		features |= CPU_SSE2;
+#endif
+	return features;
+}
+
+/** @brief wall clock in seconds, for timing the candidates */
+static double seconds()
+{
+	LARGE_INTEGER count, frequency;
+
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return (double)count.QuadPart / (double)frequency.QuadPart;
+}
+
+/** @brief compares k against the reference over every possible input */
+static int bit_exact(const struct g711_slot *slot, const struct g711_kernel *k)
+{
+	int inputs = slot->encode ? 65536 : 256;
+	int in_size = slot->encode ? 2 : 1;
+	int out_size = slot->encode ? 1 : 2;
+	char *src = (char *)malloc(inputs * in_size);
+	char *expect = (char *)malloc(inputs * out_size);
+	char *got = (char *)malloc(inputs * out_size);
+	int i, same = 0;
+
+	if (src == NULL || expect == NULL || got == NULL)
+		goto done;
+	for (i = 0; i < inputs; i++)
+	{
+		if (slot->encode)
+			((unsigned short *)src)[i] = (unsigned short)i;
+		else
+			src[i] = (char)i;
+	}
+	slot->candidates[0].fn(inputs * in_size, src, expect);
+	k->fn(inputs * in_size, src, got);
+	same = memcmp(expect, got, inputs * out_size) == 0;
+done:
+	free(got);
+	free(expect);
+	free(src);
+	return same;
+}
+
+/** @brief best of three timings of k over block_size samples,
+in nanoseconds per sample */
+static double time_kernel(const struct g711_slot *slot, const struct g711_kernel *k,
+	const char *src, char *dst, int block_size)
+{
+	int in_size = slot->encode ? 2 : 1;
+	int reps = 1 + 262144 / block_size;
+	int trial, r;
+	double start, elapsed, best = 0.0;
+
+	for (trial = 0; trial < 3; trial++)
+	{
+		start = seconds();
+		for (r = 0; r < reps; r++)
+			k->fn(block_size * in_size, src, dst);
+		elapsed = seconds() - start;
+		if (trial == 0 || elapsed < best)
+			best = elapsed;
+	}
+	return best * 1e9 / ((double)reps * block_size);
+}
+
+/** @brief binds the fastest bit exact kernel the CPU supports to each
+entry point, timed over blocks of block_size samples */
+void g711_autotune(int block_size)
+{
+	unsigned features = g711_cpu_features();
+	unsigned long seed = 12345;
+	char *src, *dst;
+	unsigned i;
+	int c;
+	double ns, best_ns;
+	const struct g711_kernel *k;
+
+	pcm16_alaw_tableinit();
+	pcm16_ulaw_tableinit();
+	alaw_pcm16_tableinit();
+	ulaw_pcm16_tableinit();
+
+	/* noise at speech level: neither all silence nor all clipping */
+	src = (char *)malloc(block_size * 2);
+	dst = (char *)malloc(block_size * 2);
+	if (src == NULL || dst == NULL)
+	{
+		printf("Not enough memory to autotune, keeping the table kernels.\n");
+		free(src);
+		free(dst);
+		return;
+	}
+	for (c = 0; c < block_size; c++)
+	{
+		seed = seed * 1103515245UL + 12345UL;
+		((short *)src)[c] = (short)((long)((seed >> 16) & 0xFFFF) - 32768) / 4;
+	}
+
+	for (i = 0; i < SLOTS; i++)
+	{
+		printf("%s:", slots[i].name);
+		best_ns = 0.0;
+		for (c = 0; c < slots[i].count; c++)
+		{
+			k = &slots[i].candidates[c];
+			if ((k->features & features) != k->features)
+				continue;
+			if (!bit_exact(&slots[i], k))
+			{
+				printf(" %s not bit exact,", k->name);
+				continue;
+			}
+			ns = time_kernel(&slots[i], k, src, dst, block_size);
+			printf(" %s %.1fns", k->name, ns);
+			if (best_ns == 0.0 || ns < best_ns)
+			{
+				best_ns = ns;
+				slots[i].bound = k;
+			}
+		}
+		printf(" -> %s\n", slots[i].bound->name);
+	}
+	free(dst);
+	free(src);
+}
+
+/** @brief prints the CPU features and the kernels bound to each entry */
+void g711_print_kernels()
+{
+	unsigned features = g711_cpu_features();
+	unsigned i;
+
+	printf("CPU features:%s\n", features & CPU_SSE2 ? " SSE2" : " none");
+	for (i = 0; i < SLOTS; i++)
+		printf("%s: %s\n", slots[i].name, slots[i].bound->name);
+}
@@ -0,0 +1,35 @@
+/** @file g711_dispatch.h
+
+	@brief Runtime selection of the kernels behind pcm16_to_alaw,
+	pcm16_to_ulaw, alaw_to_pcm16 and ulaw_to_pcm16.
+
+	Each of the four has a list of candidate kernels, tagged with the
+	CPU features they need. Until g711_autotune() runs, the plain table
+	kernels are bound. g711_autotune() checks every candidate the CPU
+	can run for bit exactness against the reference search()-based
+	functions in g711.c, times it at the given block size and binds
+	the fastest one.
+*/
+#ifndef G711_DISPATCH_H
+#define G711_DISPATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief x86 SSE2, needed by the SSE2 encoders */
+#define CPU_SSE2   0x01
+
+/** @brief raised whenever a kernel, the resampler or the dither
+gives different output, which retires every cached conversion */
+#define G711_KERNEL_VERSION 1
+
+unsigned g711_cpu_features();
+void g711_autotune(int block_size);
+void g711_print_kernels();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* G711_DISPATCH_H */
@@ -0,0 +1,215 @@
+/** @file g711_iov.c
+
+	@brief Converting between segment lists, as found in packet chains
+	and ring buffers, without first copying them into one buffer.
+
+	The kernels are the ones bound by g711_dispatch.c, so the tables
+	must have been built before the first call. They load and store
+	PCM16 as halfwords, which ARMv4I can only do at even addresses, so
+	PCM16 at an odd address takes the bounce buffer too.
+*/
+#include "stdafx.h"
+#include "g711_batch.h"
+#include "g711_iov.h"
+
+/** @brief samples converted at a time through the bounce buffer */
+#define IOV_BOUNCE 64
+
+/** @brief the signature every kernel shares */
+typedef void (*iov_kernel)(int, const char *, char *);
+
+/** @brief a position in a segment list */
+struct iov_cursor {
+	/** @brief the list */
+	const struct g711_iovec *iov;
+	/** @brief number of segments */
+	int count;
+	/** @brief current segment */
+	int seg;
+	/** @brief bytes used of the current segment */
+	int off;
+};
+
+/** @brief moves past used up and empty segments */
+static void settle(struct iov_cursor *c)
+{
+	while (c->seg < c->count && c->off >= c->iov[c->seg].len)
+	{
+		c->seg++;
+		c->off = 0;
+	}
+}
+
+/** @brief puts c at the first byte of iov */
+static void start(struct iov_cursor *c, const struct g711_iovec *iov, int count)
+{
+	c->iov = iov;
+	c->count = count;
+	c->seg = 0;
+	c->off = 0;
+	settle(c);
+}
+
+/** @brief bytes left in the current segment */
+static int avail(const struct iov_cursor *c)
+{
+	return c->iov[c->seg].len - c->off;
+}
+
+/** @brief the current byte */
+static char *here(const struct iov_cursor *c)
+{
+	return c->iov[c->seg].base + c->off;
+}
+
+/** @brief steps bytes on, no further than the end of the segment */
+static void advance(struct iov_cursor *c, int bytes)
+{
+	c->off += bytes;
+	settle(c);
+}
+
+/** @brief copies bytes out of the list, across segments */
+static void gather(struct iov_cursor *c, char *out, int bytes)
+{
+	int n;
+
+	while (bytes > 0)
+	{
+		n = avail(c) < bytes ? avail(c) : bytes;
+		memcpy(out, here(c), n);
+		out += n;
+		bytes -= n;
+		advance(c, n);
+	}
+}
+
+/** @brief copies bytes into the list, across segments */
+static void scatter(struct iov_cursor *c, const char *in, int bytes)
+{
+	int n;
+
+	while (bytes > 0)
+	{
+		n = avail(c) < bytes ? avail(c) : bytes;
+		memcpy(here(c), in, n);
+		in += n;
+		bytes -= n;
+		advance(c, n);
+	}
+}
+
+/** @brief bytes in a list */
+static int total(const struct g711_iovec *iov, int count)
+{
+	int i, bytes = 0;
+
+	for (i = 0; i < count; i++)
+		bytes += iov[i].len;
+	return bytes;
+}
+
+/** @brief encodes the PCM16 in src into dst, with law G711_ALAW or
+G711_ULAW. returns the number of samples, as many as both lists hold */
+int g711_encode_iov(int law, const struct g711_iovec *src, int src_count,
+	const struct g711_iovec *dst, int dst_count)
+{
+	struct iov_cursor s, d;
+	short bounce[IOV_BOUNCE];
+	iov_kernel kernel = law == G711_ALAW ? pcm16_to_alaw : pcm16_to_ulaw;
+	int samples, left, n;
+
+	samples = total(src, src_count) / 2;
+	if (samples > total(dst, dst_count))
+		samples = total(dst, dst_count);
+	start(&s, src, src_count);
+	start(&d, dst, dst_count);
+	for (left = samples; left > 0; left -= n)
+	{
+		n = avail(&d) < left ? avail(&d) : left;
+		if (avail(&s) >= 2 && ((size_t)here(&s) & 1) == 0)
+		{
+			/* contiguous on both sides */
+			if (n > avail(&s) / 2)
+				n = avail(&s) / 2;
+			kernel(n * 2, here(&s), here(&d));
+			advance(&s, n * 2);
+		}
+		else
+		{
+			/* one sample split across segments, or a run at an odd address */
+			if (avail(&s) < 2)
+				n = 1;
+			else if (n > avail(&s) / 2)
+				n = avail(&s) / 2;
+			if (n > IOV_BOUNCE)
+				n = IOV_BOUNCE;
+			gather(&s, (char *)bounce, n * 2);
+			kernel(n * 2, (const char *)bounce, here(&d));
+		}
+		advance(&d, n);
+	}
+	return samples;
+}
+
+/** @brief decodes the G711 in src into PCM16 in dst, with law
+G711_ALAW or G711_ULAW. returns the number of samples, as many as both
+lists hold */
+int g711_decode_iov(int law, const struct g711_iovec *src, int src_count,
+	const struct g711_iovec *dst, int dst_count)
+{
+	struct iov_cursor s, d;
+	short bounce[IOV_BOUNCE];
+	iov_kernel kernel = law == G711_ALAW ? alaw_to_pcm16 : ulaw_to_pcm16;
+	int samples, left, n;
+
+	samples = total(src, src_count);
+	if (samples > total(dst, dst_count) / 2)
+		samples = total(dst, dst_count) / 2;
+	start(&s, src, src_count);
+	start(&d, dst, dst_count);
+	for (left = samples; left > 0; left -= n)
+	{
+		n = avail(&s) < left ? avail(&s) : left;
+		if (avail(&d) >= 2 && ((size_t)here(&d) & 1) == 0)
+		{
+			if (n > avail(&d) / 2)
+				n = avail(&d) / 2;
+			kernel(n, here(&s), here(&d));
+			advance(&d, n * 2);
+		}
+		else
+		{
+			if (avail(&d) < 2)
+				n = 1;
+			else if (n > avail(&d) / 2)
+				n = avail(&d) / 2;
+			if (n > IOV_BOUNCE)
+				n = IOV_BOUNCE;
+			kernel(n, here(&s), (char *)bounce);
+			scatter(&d, (const char *)bounce, n * 2);
+		}
+		advance(&s, n);
+	}
+	return samples;
+}
+
+/** @brief describes len bytes from offset of a ring buffer of size
+bytes as one segment, or two when they wrap past the end. offset must
+lie within the ring and len can not exceed size. returns the number of
+segments written to iov, 0 when len is 0, or -1 if the arguments are
+out of range */
+int g711_ring_iov(char *ring, int size, int offset, int len, struct g711_iovec *iov)
+{
+	if (size <= 0 || offset < 0 || offset >= size || len < 0 || len > size)
+		return -1;
+	if (len == 0)
+		return 0;
+	iov[0].base = ring + offset;
+	iov[0].len = len < size - offset ? len : size - offset;
+	if (iov[0].len == len)
+		return 1;
+	iov[1].base = ring;
+	iov[1].len = len - iov[0].len;
+	return 2;
+}
@@ -0,0 +1,37 @@
+/** @file g711_iov.h
+
+	@brief Converting between segment lists, as found in packet chains
+	and ring buffers, without first copying them into one buffer.
+
+	Both sides are lists of segments of any length, and a PCM16 sample
+	may start in one segment and end in the next. Each stretch that is
+	contiguous (and halfword aligned) on both sides goes to the bound
+	kernel in one call. Only samples split across a boundary, or sitting
+	at an odd address, go through a small bounce buffer.
+*/
+#ifndef G711_IOV_H
+#define G711_IOV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief one segment of a list */
+struct g711_iovec {
+	/** @brief first byte */
+	char *base;
+	/** @brief length in bytes */
+	int len;
+};
+
+int g711_encode_iov(int law, const struct g711_iovec *src, int src_count,
+	const struct g711_iovec *dst, int dst_count);
+int g711_decode_iov(int law, const struct g711_iovec *src, int src_count,
+	const struct g711_iovec *dst, int dst_count);
+int g711_ring_iov(char *ring, int size, int offset, int len, struct g711_iovec *iov);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* G711_IOV_H */
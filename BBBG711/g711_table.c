@@ -2,6 +2,9 @@
 #define G711_TABLE_H
 
 #include "g711.h"
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 /** 16384 entries per table (16 bit) */
 unsigned char linear_to_alaw[65536];
@@ -11,6 +14,20 @@ unsigned char linear_to_ulaw[65536];
 unsigned short alaw_to_linear[256];
 unsigned short ulaw_to_linear[256];
 
+/** 8192/16384 entries: A-law drops the low 3 bits of the input and
+    u-law the low 2 before anything else, so indexing with those bits
+    shifted out is bit exact and the table fits in a small L1 cache */
+unsigned char linear_to_alaw_compact[8192];
+unsigned char linear_to_ulaw_compact[16384];
+
+/** 256 entries per table (8 bit -> float32 in [-1.0, 1.0)) */
+float alaw_to_float[256];
+float ulaw_to_float[256];
+
+/** TPDF dither on the 24 bit path, see pcm24_dither() */
+static int dither_enabled = 0;
+static unsigned long dither_seed = 22222;
+
 static void build_linear_to_xlaw_table(unsigned char *linear_to_xlaw,
                                        unsigned char (*linear2xlaw)(short))
 {
@@ -21,6 +38,16 @@ static void build_linear_to_xlaw_table(unsigned char *linear_to_xlaw,
     }
 }
 
+static void build_compact_table(unsigned char *linear_to_xlaw, int shift,
+                                unsigned char (*linear2xlaw)(short))
+{
+    int i;
+
+    for (i=0; i < (65536 >> shift); i++){
+        linear_to_xlaw[i] = linear2xlaw((short) (i << shift));
+    }
+}
+
 static void build_xlaw_to_linear_table(unsigned short *xlaw_to_linear,
                                        short (*xlaw2linear)(unsigned char))
 {
@@ -31,6 +58,23 @@ static void build_xlaw_to_linear_table(unsigned short *xlaw_to_linear,
     }
 }
 
+static void build_xlaw_to_float_table(float *xlaw_to_float,
+                                      short (*xlaw2linear)(unsigned char))
+{
+    int i;
+
+    for (i=0; i<256;i++){
+        xlaw_to_float[i] = (float) xlaw2linear(i) / 32768.0f;
+    }
+}
+
+/** returns a uniformly distributed value in [0, 255] */
+static int dither_rand()
+{
+    dither_seed = dither_seed * 1103515245UL + 12345UL;
+    return (int) ((dither_seed >> 16) & 0xFF);
+}
+
 static void pcm16_to_xlaw(unsigned char *linear_to_xlaw, int src_length, const char *src_samples, char *dst_samples)
 {
     int i;
@@ -44,6 +88,42 @@ static void pcm16_to_xlaw(unsigned char *linear_to_xlaw, int src_length, const c
     }
 }
 
+static void pcm16_to_xlaw_compact(unsigned char *linear_to_xlaw, int shift, int src_length, const char *src_samples, char *dst_samples)
+{
+    int i;
+    const unsigned short *s_samples;
+
+    s_samples = (const unsigned short *)src_samples;
+
+    for (i=0; i < src_length / 2; i++)
+    {
+        dst_samples[i] = linear_to_xlaw[s_samples[i] >> shift];
+    }
+}
+
+/** four samples per pass, so the loads and the stores overlap */
+static void xlaw_to_pcm16_unrolled(unsigned short *xlaw_to_linear, int src_length, const char *src_samples, char *dst_samples)
+{
+    int i;
+    unsigned char *s_samples;
+    unsigned short *d_samples;
+
+    s_samples = (unsigned char *) src_samples;
+    d_samples = (unsigned short *)dst_samples;
+
+    for (i=0; i + 4 <= src_length; i += 4)
+    {
+        d_samples[i] = xlaw_to_linear[s_samples[i]];
+        d_samples[i + 1] = xlaw_to_linear[s_samples[i + 1]];
+        d_samples[i + 2] = xlaw_to_linear[s_samples[i + 2]];
+        d_samples[i + 3] = xlaw_to_linear[s_samples[i + 3]];
+    }
+    for (; i < src_length; i++)
+    {
+        d_samples[i] = xlaw_to_linear[s_samples[i]];
+    }
+}
+
 static void xlaw_to_pcm16(unsigned short *xlaw_to_linear, int src_length, const char *src_samples, char *dst_samples)
 {
     int i;
@@ -59,34 +139,356 @@ static void xlaw_to_pcm16(unsigned short *xlaw_to_linear, int src_length, const
     }
 }
 
-void pcm16_to_alaw(int src_length, const char *src_samples, char *dst_samples)
+/** converts one float32 sample to 16 bit, rounded and clipped, NaN to 0 */
+static short float_to_linear(float f)
+{
+    /* NaN fails both clamps below, and converting it is undefined */
+    if (f != f)
+        return 0;
+    f *= 32768.0f;
+    if (f >= 32767.0f)
+        return 32767;
+    if (f <= -32768.0f)
+        return -32768;
+    return (short) (f < 0.0f ? f - 0.5f : f + 0.5f);
+}
+
+/** converts one packed 24 bit sample to 16 bit, rounded and clipped */
+static short pcm24_to_linear(const unsigned char *sample)
+{
+    long val;
+
+    /* little endian, sign extended from bit 23 */
+    val = (long) sample[0] | ((long) sample[1] << 8) | ((long) sample[2] << 16);
+    val = (val ^ 0x800000L) - 0x800000L;
+    /* TPDF dither of +/- one 16 bit LSB, then round to 16 bits */
+    if (dither_enabled)
+        val += dither_rand() - dither_rand();
+    val = (val + 0x80) >> 8;
+    if (val > 32767)
+        val = 32767;
+    else if (val < -32768)
+        val = -32768;
+    return (short) val;
+}
+
+/** src_stride and dst_stride are in samples, so one loop covers
+    interleaving, de-interleaving and single channel extraction */
+static void pcm16_to_xlaw_strided(unsigned char *linear_to_xlaw, int frames, const char *src_samples, int src_stride, char *dst_samples, int dst_stride)
+{
+    int i;
+    const unsigned short *s_samples;
+
+    s_samples = (const unsigned short *)src_samples;
+
+    for (i=0; i < frames; i++)
+    {
+        *dst_samples = linear_to_xlaw[*s_samples];
+        s_samples += src_stride;
+        dst_samples += dst_stride;
+    }
+}
+
+static void xlaw_to_pcm16_strided(unsigned short *xlaw_to_linear, int frames, const char *src_samples, int src_stride, char *dst_samples, int dst_stride)
+{
+    int i;
+    const unsigned char *s_samples;
+    unsigned short *d_samples;
+
+    s_samples = (const unsigned char *) src_samples;
+    d_samples = (unsigned short *)dst_samples;
+
+    for (i=0; i < frames; i++)
+    {
+        *d_samples = xlaw_to_linear[*s_samples];
+        s_samples += src_stride;
+        d_samples += dst_stride;
+    }
+}
+
+static void float32_to_xlaw(unsigned char *linear_to_xlaw, int src_length, const char *src_samples, char *dst_samples)
+{
+    int i;
+    const float *s_samples;
+
+    s_samples = (const float *)src_samples;
+
+    for (i=0; i < src_length / 4; i++)
+    {
+        dst_samples[i] = linear_to_xlaw[(unsigned short) float_to_linear(s_samples[i])];
+    }
+}
+
+static void xlaw_to_float32(float *xlaw_to_float, int src_length, const char *src_samples, char *dst_samples)
+{
+    int i;
+    unsigned char *s_samples;
+    float *d_samples;
+
+    s_samples = (unsigned char *) src_samples;
+    d_samples = (float *)dst_samples;
+
+    for (i=0; i < src_length; i++)
+    {
+        d_samples[i] = xlaw_to_float[s_samples[i]];
+    }
+}
+
+static void pcm24_to_xlaw(unsigned char *linear_to_xlaw, int src_length, const char *src_samples, char *dst_samples)
+{
+    int i;
+    const unsigned char *s_samples;
+
+    s_samples = (const unsigned char *)src_samples;
+
+    for (i=0; i < src_length / 3; i++)
+    {
+        dst_samples[i] = linear_to_xlaw[(unsigned short) pcm24_to_linear(s_samples + 3 * i)];
+    }
+}
+
+void pcm16_to_alaw_table(int src_length, const char *src_samples, char *dst_samples)
 {
     pcm16_to_xlaw(linear_to_alaw, src_length, src_samples, dst_samples);
 }
 
-void pcm16_to_ulaw(int src_length, const char *src_samples, char *dst_samples)
+void pcm16_to_ulaw_table(int src_length, const char *src_samples, char *dst_samples)
 {
     pcm16_to_xlaw(linear_to_ulaw, src_length, src_samples, dst_samples);
 }
 
-void alaw_to_pcm16(int src_length, const char *src_samples, char *dst_samples)
+void alaw_to_pcm16_table(int src_length, const char *src_samples, char *dst_samples)
 {
     xlaw_to_pcm16(alaw_to_linear, src_length, src_samples, dst_samples);
 }
 
-void ulaw_to_pcm16(int src_length, const char *src_samples, char *dst_samples)
+void ulaw_to_pcm16_table(int src_length, const char *src_samples, char *dst_samples)
 {
     xlaw_to_pcm16(ulaw_to_linear, src_length, src_samples, dst_samples);
 }
 
+void pcm16_to_alaw_compact(int src_length, const char *src_samples, char *dst_samples)
+{
+    pcm16_to_xlaw_compact(linear_to_alaw_compact, 3, src_length, src_samples, dst_samples);
+}
+
+void pcm16_to_ulaw_compact(int src_length, const char *src_samples, char *dst_samples)
+{
+    pcm16_to_xlaw_compact(linear_to_ulaw_compact, 2, src_length, src_samples, dst_samples);
+}
+
+void alaw_to_pcm16_unrolled(int src_length, const char *src_samples, char *dst_samples)
+{
+    xlaw_to_pcm16_unrolled(alaw_to_linear, src_length, src_samples, dst_samples);
+}
+
+void ulaw_to_pcm16_unrolled(int src_length, const char *src_samples, char *dst_samples)
+{
+    xlaw_to_pcm16_unrolled(ulaw_to_linear, src_length, src_samples, dst_samples);
+}
+
+#if defined(_M_IX86) || defined(_M_X64)
+/** segment of each lane, how many of the segment ends it is past,
+    and in *scale 0x8000 halved once for each end past from first_end
+    on. SSE2 has no per lane shift, so the caller shifts by multiplying
+    by scale and keeping the high half. */
+static __m128i segment(__m128i mag, const short *seg_end, int first_end, __m128i *scale)
+{
+    __m128i seg = _mm_setzero_si128();
+    __m128i s = _mm_set1_epi16((short)0x8000);
+    __m128i past;
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        past = _mm_cmpgt_epi16(mag, _mm_set1_epi16(seg_end[i]));
+        seg = _mm_sub_epi16(seg, past);
+        if (i >= first_end)
+            s = _mm_sub_epi16(s, _mm_and_si128(_mm_srli_epi16(s, 1), past));
+    }
+    *scale = s;
+    return seg;
+}
+
+/** linear2alaw() eight samples at a time, no tables */
+void pcm16_to_alaw_sse2(int src_length, const char *src_samples, char *dst_samples)
+{
+    static const short seg_end[8] = {0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF};
+    int i, n = src_length / 2;
+    __m128i v, neg, mag, seg, scale, aval;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        v = _mm_srai_epi16(_mm_loadu_si128((const __m128i *)(src_samples + i * 2)), 3);
+        /* negative values become -v - 1, which is ~v */
+        neg = _mm_srai_epi16(v, 15);
+        mag = _mm_xor_si128(v, neg);
+        /* mag >> seg, where segments 0 and 1 both shift by 1 */
+        seg = segment(mag, seg_end, 1, &scale);
+        aval = _mm_or_si128(_mm_slli_epi16(seg, 4),
+            _mm_and_si128(_mm_mulhi_epu16(mag, scale), _mm_set1_epi16(0xF)));
+        aval = _mm_xor_si128(aval, _mm_xor_si128(_mm_set1_epi16(0xD5),
+            _mm_and_si128(neg, _mm_set1_epi16(0x80))));
+        _mm_storel_epi64((__m128i *)(dst_samples + i), _mm_packus_epi16(aval, aval));
+    }
+    for (; i < n; i++)
+        dst_samples[i] = linear2alaw(((const short *)src_samples)[i]);
+}
+
+/** linear2ulaw() eight samples at a time, no tables */
+void pcm16_to_ulaw_sse2(int src_length, const char *src_samples, char *dst_samples)
+{
+    static const short seg_end[8] = {0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF};
+    int i, n = src_length / 2;
+    __m128i v, neg, mag, seg, scale, over, uval;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        v = _mm_srai_epi16(_mm_loadu_si128((const __m128i *)(src_samples + i * 2)), 2);
+        neg = _mm_srai_epi16(v, 15);
+        mag = _mm_sub_epi16(_mm_xor_si128(v, neg), neg);
+        mag = _mm_add_epi16(_mm_min_epi16(mag, _mm_set1_epi16(8159)), _mm_set1_epi16(0x84 >> 2));
+        /* mag >> (seg + 1) */
+        seg = segment(mag, seg_end, 0, &scale);
+        uval = _mm_or_si128(_mm_slli_epi16(seg, 4),
+            _mm_and_si128(_mm_mulhi_epu16(mag, scale), _mm_set1_epi16(0xF)));
+        /* past the last segment is the largest code */
+        over = _mm_cmpeq_epi16(seg, _mm_set1_epi16(8));
+        uval = _mm_or_si128(_mm_and_si128(over, _mm_set1_epi16(0x7F)), _mm_andnot_si128(over, uval));
+        uval = _mm_xor_si128(uval, _mm_xor_si128(_mm_set1_epi16(0xFF),
+            _mm_and_si128(neg, _mm_set1_epi16(0x80))));
+        _mm_storel_epi64((__m128i *)(dst_samples + i), _mm_packus_epi16(uval, uval));
+    }
+    for (; i < n; i++)
+        dst_samples[i] = linear2ulaw(((const short *)src_samples)[i]);
+}
+#endif
+
+void float32_to_alaw(int src_length, const char *src_samples, char *dst_samples)
+{
+    float32_to_xlaw(linear_to_alaw, src_length, src_samples, dst_samples);
+}
+
+void float32_to_ulaw(int src_length, const char *src_samples, char *dst_samples)
+{
+    float32_to_xlaw(linear_to_ulaw, src_length, src_samples, dst_samples);
+}
+
+void alaw_to_float32(int src_length, const char *src_samples, char *dst_samples)
+{
+    xlaw_to_float32(alaw_to_float, src_length, src_samples, dst_samples);
+}
+
+void ulaw_to_float32(int src_length, const char *src_samples, char *dst_samples)
+{
+    xlaw_to_float32(ulaw_to_float, src_length, src_samples, dst_samples);
+}
+
+void pcm24_to_alaw(int src_length, const char *src_samples, char *dst_samples)
+{
+    pcm24_to_xlaw(linear_to_alaw, src_length, src_samples, dst_samples);
+}
+
+void pcm24_to_ulaw(int src_length, const char *src_samples, char *dst_samples)
+{
+    pcm24_to_xlaw(linear_to_ulaw, src_length, src_samples, dst_samples);
+}
+
+void pcm16_to_alaw_strided(int frames, const char *src_samples, int src_stride, char *dst_samples, int dst_stride)
+{
+    pcm16_to_xlaw_strided(linear_to_alaw, frames, src_samples, src_stride, dst_samples, dst_stride);
+}
+
+void pcm16_to_ulaw_strided(int frames, const char *src_samples, int src_stride, char *dst_samples, int dst_stride)
+{
+    pcm16_to_xlaw_strided(linear_to_ulaw, frames, src_samples, src_stride, dst_samples, dst_stride);
+}
+
+void alaw_to_pcm16_strided(int frames, const char *src_samples, int src_stride, char *dst_samples, int dst_stride)
+{
+    xlaw_to_pcm16_strided(alaw_to_linear, frames, src_samples, src_stride, dst_samples, dst_stride);
+}
+
+void ulaw_to_pcm16_strided(int frames, const char *src_samples, int src_stride, char *dst_samples, int dst_stride)
+{
+    xlaw_to_pcm16_strided(ulaw_to_linear, frames, src_samples, src_stride, dst_samples, dst_stride);
+}
+
+void copy_strided(int frames, int sample_size, const char *src_samples, int src_stride, char *dst_samples, int dst_stride)
+{
+    int i, j;
+
+    for (i=0; i < frames; i++)
+    {
+        for (j=0; j < sample_size; j++)
+        {
+            dst_samples[j] = src_samples[j];
+        }
+        src_samples += src_stride * sample_size;
+        dst_samples += dst_stride * sample_size;
+    }
+}
+
+void float32_to_pcm16(int src_length, const char *src_samples, char *dst_samples)
+{
+    int i;
+    const float *s_samples;
+    short *d_samples;
+
+    s_samples = (const float *)src_samples;
+    d_samples = (short *)dst_samples;
+
+    for (i=0; i < src_length / 4; i++)
+    {
+        d_samples[i] = float_to_linear(s_samples[i]);
+    }
+}
+
+void pcm24_to_pcm16(int src_length, const char *src_samples, char *dst_samples)
+{
+    int i;
+    const unsigned char *s_samples;
+    short *d_samples;
+
+    s_samples = (const unsigned char *)src_samples;
+    d_samples = (short *)dst_samples;
+
+    for (i=0; i < src_length / 3; i++)
+    {
+        d_samples[i] = pcm24_to_linear(s_samples + 3 * i);
+    }
+}
+
+void pcm16_to_float32(int src_length, const char *src_samples, char *dst_samples)
+{
+    int i;
+    const short *s_samples;
+    float *d_samples;
+
+    s_samples = (const short *)src_samples;
+    d_samples = (float *)dst_samples;
+
+    for (i=0; i < src_length / 2; i++)
+    {
+        d_samples[i] = (float) s_samples[i] / 32768.0f;
+    }
+}
+
+void pcm24_dither(int enable)
+{
+    dither_enabled = enable;
+}
+
 void pcm16_alaw_tableinit()
 {
     build_linear_to_xlaw_table(linear_to_alaw, linear2alaw);
+    build_compact_table(linear_to_alaw_compact, 3, linear2alaw);
 }
 
 void pcm16_ulaw_tableinit()
 {
     build_linear_to_xlaw_table(linear_to_ulaw, linear2ulaw);
+    build_compact_table(linear_to_ulaw_compact, 2, linear2ulaw);
 }
 
 void alaw_pcm16_tableinit()
@@ -99,4 +501,14 @@ void ulaw_pcm16_tableinit()
     build_xlaw_to_linear_table(ulaw_to_linear, ulaw2linear);
 }
 
+void alaw_float32_tableinit()
+{
+    build_xlaw_to_float_table(alaw_to_float, alaw2linear);
+}
+
+void ulaw_float32_tableinit()
+{
+    build_xlaw_to_float_table(ulaw_to_float, ulaw2linear);
+}
+
 #endif // G711_TABLE_H
@@ -1,14 +1,56 @@
 #ifndef G711_TABLE_H
 #define G711_TABLE_H
 
+/* these four run whichever kernel g711_dispatch.c has bound,
+   the table kernels until g711_autotune() says otherwise */
 void pcm16_to_alaw(int length, const char *src_samples, char *dst_samples);
 void pcm16_to_ulaw(int length, const char *src_samples, char *dst_samples);
 void alaw_to_pcm16(int length, const char *src_samples, char *dst_samples);
 void ulaw_to_pcm16(int length, const char *src_samples, char *dst_samples);
 
+/* the candidates behind them */
+void pcm16_to_alaw_table(int length, const char *src_samples, char *dst_samples);
+void pcm16_to_ulaw_table(int length, const char *src_samples, char *dst_samples);
+void alaw_to_pcm16_table(int length, const char *src_samples, char *dst_samples);
+void ulaw_to_pcm16_table(int length, const char *src_samples, char *dst_samples);
+void pcm16_to_alaw_compact(int length, const char *src_samples, char *dst_samples);
+void pcm16_to_ulaw_compact(int length, const char *src_samples, char *dst_samples);
+void alaw_to_pcm16_unrolled(int length, const char *src_samples, char *dst_samples);
+void ulaw_to_pcm16_unrolled(int length, const char *src_samples, char *dst_samples);
+#if defined(_M_IX86) || defined(_M_X64)
+void pcm16_to_alaw_sse2(int length, const char *src_samples, char *dst_samples);
+void pcm16_to_ulaw_sse2(int length, const char *src_samples, char *dst_samples);
+#endif
+
+/* strides are in samples: src_stride = nChannels with src_samples 
+   offset to a channel encodes or decodes just that channel */
+void pcm16_to_alaw_strided(int frames, const char *src_samples, int src_stride, char *dst_samples, int dst_stride);
+void pcm16_to_ulaw_strided(int frames, const char *src_samples, int src_stride, char *dst_samples, int dst_stride);
+void alaw_to_pcm16_strided(int frames, const char *src_samples, int src_stride, char *dst_samples, int dst_stride);
+void ulaw_to_pcm16_strided(int frames, const char *src_samples, int src_stride, char *dst_samples, int dst_stride);
+void copy_strided(int frames, int sample_size, const char *src_samples, int src_stride, char *dst_samples, int dst_stride);
+
+/* float32 samples are in [-1.0, 1.0), src_length is in bytes */
+void float32_to_alaw(int length, const char *src_samples, char *dst_samples);
+void float32_to_ulaw(int length, const char *src_samples, char *dst_samples);
+void alaw_to_float32(int length, const char *src_samples, char *dst_samples);
+void ulaw_to_float32(int length, const char *src_samples, char *dst_samples);
+
+/* packed little endian 24 bit samples, TPDF dither if pcm24_dither(1) */
+void pcm24_to_alaw(int length, const char *src_samples, char *dst_samples);
+void pcm24_to_ulaw(int length, const char *src_samples, char *dst_samples);
+void pcm24_dither(int enable);
+
+/* format conversions feeding the resampler, no tables needed */
+void float32_to_pcm16(int length, const char *src_samples, char *dst_samples);
+void pcm24_to_pcm16(int length, const char *src_samples, char *dst_samples);
+void pcm16_to_float32(int length, const char *src_samples, char *dst_samples);
+
 void pcm16_alaw_tableinit();
 void pcm16_ulaw_tableinit();
 void alaw_pcm16_tableinit();
 void ulaw_pcm16_tableinit();
+void alaw_float32_tableinit();
+void ulaw_float32_tableinit();
 
 #endif // G711_TABLE_H
\ No newline at end of file
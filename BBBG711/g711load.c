@@ -0,0 +1,693 @@
+/** @file g711load.c
+
+	@brief A load generator that answers "how many calls per box".
+
+	Simulates N concurrent calls. Each call delivers one 20ms frame
+	per tick on a real time clock, and worker threads push the frames
+	through the G711 kernels (and the resampler with -rate) the way a
+	media gateway would. Every frame's latency is measured from the
+	moment it was due to the moment its conversion finished; a frame
+	that is not done before the next one is due has missed its
+	deadline. The audio is synthetic, so no input files are needed.
+*/
+#include "stdafx.h"
+#include <math.h>
+#include "resample.h"
+#include "g711_dispatch.h"
+#include "g711_batch.h"
+
+/** @brief the only sample rate G.711 is defined at */
+#define G711_RATE 8000
+/** @brief length of one frame in milliseconds */
+#define FRAME_MS 20
+/** @brief samples in one G711 frame */
+#define FRAME_SAMPLES (G711_RATE * FRAME_MS / 1000)
+/** @brief different synthetic signals the calls share */
+#define SOURCES 16
+/** @brief frames in each synthetic signal, one second */
+#define SOURCE_FRAMES 50
+/** @brief latencies are counted in 1us buckets up to this many */
+#define LATENCY_BUCKETS 100000
+/** @brief a load is sustainable while at most this fraction of
+frames miss their deadline */
+#define SUSTAINABLE_MISSES 0.001
+
+/** @brief what each call does with its frames */
+enum load_mode { MODE_TRANSCODE, MODE_DECODE, MODE_ENCODE };
+
+/** @brief command line settings */
+struct load_options {
+	/** @brief concurrent calls, the first step with -sweep */
+	int calls;
+	/** @brief worker threads */
+	int threads;
+	/** @brief length of each run */
+	int seconds;
+	/** @brief one of load_mode */
+	int mode;
+	/** @brief G711_ALAW, G711_ULAW or -1 for alternating calls */
+	int law;
+	/** @brief PCM side sample rate for -decode and -encode */
+	int rate;
+	/** @brief convert each thread's frames with the batch API */
+	int batch;
+	/** @brief bind the fastest kernels first */
+	int autotune;
+	/** @brief search for the largest sustainable call count */
+	int sweep;
+};
+
+/** @brief one simulated call */
+struct call {
+	/** @brief law of the G711 side */
+	int law;
+	/** @brief synthetic signal it plays */
+	int source;
+	/** @brief next frame of the signal */
+	int frame;
+	/** @brief rate converter for -rate, up is 0 when unused */
+	struct resampler rs;
+};
+
+/** @brief one worker thread and the calls it serves */
+struct worker {
+	const struct load_options *opts;
+	/** @brief its calls */
+	struct call *calls;
+	/** @brief number of calls */
+	int count;
+	/** @brief tick time of the first frame, in counter ticks */
+	LONGLONG start;
+	/** @brief counter ticks per second */
+	LONGLONG frequency;
+	/** @brief input frames, count of them */
+	char *in;
+	/** @brief intermediate pcm16 frames */
+	short *pcm;
+	/** @brief resampled pcm16 frames */
+	short *resampled;
+	/** @brief output frames */
+	char *out;
+	/** @brief frame descriptors for -batch */
+	struct g711_frame *frames;
+	/** @brief latency histogram in microseconds, the last bucket
+	collects everything longer */
+	unsigned long *histogram;
+	/** @brief frames converted */
+	unsigned long done;
+	/** @brief frames finished after their deadline */
+	unsigned long missed;
+	/** @brief longest latency in microseconds */
+	double worst;
+	/** @brief xor of the output, so the work can't be optimised away */
+	unsigned checksum;
+};
+
+/** @brief the results of one run */
+struct load_result {
+	unsigned long frames;
+	unsigned long missed;
+	double p50, p99, p999, worst;
+};
+
+/** @brief synthetic pcm16 at the PCM side rate, SOURCES of them */
+static short *pcm_sources;
+/** @brief samples in each pcm source frame */
+static int pcm_frame;
+/** @brief the pcm sources encoded, [law][source] */
+static unsigned char *g711_sources[2];
+
+/** @brief prints command line usage to terminal */
+void print_usage(char *program_name)
+{
+    printf("Usage: %s calls [-threads N] [-seconds N] [-decode | -encode]\n", program_name);
+    printf("       [-alaw | -ulaw] [-rate N] [-batch] [-autotune] [-sweep]\n");
+    printf("Each call sends a 20ms frame every 20ms. By default frames are\n");
+    printf("transcoded between A-law and u-law; -decode turns G711 into PCM\n");
+    printf("and -encode PCM into G711. -rate N runs the PCM side at N\n");
+    printf("samples/second through the resampler.\n");
+    printf("Calls alternate between A-law and u-law unless -alaw or -ulaw.\n");
+    printf("-batch converts each thread's frames with one batch call.\n");
+    printf("-sweep raises the call count until more than 0.1%% of frames\n");
+    printf("miss their deadline and reports the largest that did not.\n");
+}
+
+/** @brief reads the options, returns 0 when they make sense */
+int parse_options(int argc, wchar_t *argv[], struct load_options *opts)
+{
+	int i;
+
+	memset(opts, 0, sizeof(*opts));
+	opts->calls = wcstol(argv[1], NULL, 10);
+	opts->threads = 1;
+	opts->seconds = 10;
+	opts->law = -1;
+	opts->rate = G711_RATE;
+	for(i = 2; i < argc; i++)
+	{
+		if(wcscmp(argv[i], L"-threads") == 0 && i + 1 < argc)
+			opts->threads = wcstol(argv[++i], NULL, 10);
+		else if(wcscmp(argv[i], L"-seconds") == 0 && i + 1 < argc)
+			opts->seconds = wcstol(argv[++i], NULL, 10);
+		else if(wcscmp(argv[i], L"-rate") == 0 && i + 1 < argc)
+			opts->rate = wcstol(argv[++i], NULL, 10);
+		else if(wcscmp(argv[i], L"-decode") == 0)
+			opts->mode = MODE_DECODE;
+		else if(wcscmp(argv[i], L"-encode") == 0)
+			opts->mode = MODE_ENCODE;
+		else if(wcscmp(argv[i], L"-alaw") == 0)
+			opts->law = G711_ALAW;
+		else if(wcscmp(argv[i], L"-ulaw") == 0)
+			opts->law = G711_ULAW;
+		else if(wcscmp(argv[i], L"-batch") == 0)
+			opts->batch = 1;
+		else if(wcscmp(argv[i], L"-autotune") == 0)
+			opts->autotune = 1;
+		else if(wcscmp(argv[i], L"-sweep") == 0)
+			opts->sweep = 1;
+		else
+			return -1;
+	}
+	if(opts->calls <= 0 || opts->seconds <= 0 || opts->rate <= 0 ||
+		opts->threads <= 0 || opts->threads > MAXIMUM_WAIT_OBJECTS)
+		return -1;
+	/* the transcoder never leaves 8000 samples/second */
+	if(opts->mode == MODE_TRANSCODE && opts->rate != G711_RATE)
+		return -1;
+	/* the pcm side frame has to be a whole number of samples */
+	if(opts->rate % (1000 / FRAME_MS) != 0)
+		return -1;
+	return 0;
+}
+
+/** @brief builds the synthetic signals: a tone that differs per source
+over low level noise, so the frames exercise more than one segment */
+static int make_sources(int rate)
+{
+	int s, i, n;
+	unsigned long seed = 12345;
+	double phase, step;
+	struct resampler rs;
+
+	pcm_frame = rate * FRAME_MS / 1000;
+	n = SOURCE_FRAMES * pcm_frame;
+	pcm_sources = (short *)malloc(SOURCES * n * sizeof(short));
+	g711_sources[0] = (unsigned char *)malloc(SOURCES * SOURCE_FRAMES * FRAME_SAMPLES);
+	g711_sources[1] = (unsigned char *)malloc(SOURCES * SOURCE_FRAMES * FRAME_SAMPLES);
+	if(pcm_sources == NULL || g711_sources[0] == NULL || g711_sources[1] == NULL)
+		return -1;
+	for(s = 0; s < SOURCES; s++)
+	{
+		phase = 0.0;
+		step = 2.0 * 3.14159265358979 * (200.0 + 150.0 * s) / rate;
+		for(i = 0; i < n; i++)
+		{
+			seed = seed * 1103515245UL + 12345UL;
+			pcm_sources[s * n + i] = (short)(8000.0 * sin(phase) +
+				(double)((long)((seed >> 16) & 0x7FF) - 1024));
+			phase += step;
+		}
+	}
+
+	/* the G711 sources are the same signals at 8000 samples/second */
+	for(s = 0; s < SOURCES; s++)
+	{
+		const short *src = pcm_sources + s * n;
+		short *narrow = NULL;
+		int frames;
+
+		if(rate != G711_RATE)
+		{
+			if(resampler_init(&rs, rate, G711_RATE, 1) != 0)
+				return -1;
+			narrow = (short *)malloc((resampler_max_output(&rs, n) +
+				SOURCE_FRAMES * FRAME_SAMPLES) * sizeof(short));
+			if(narrow == NULL)
+				return -1;
+			frames = resampler_process(&rs, src, n, narrow);
+			frames += resampler_flush(&rs, narrow + frames);
+			resampler_free(&rs);
+			/* a rate that is not a multiple of 50 rounds the frame length */
+			for(i = frames; i < SOURCE_FRAMES * FRAME_SAMPLES; i++)
+				narrow[i] = 0;
+			src = narrow;
+		}
+		pcm16_to_alaw(SOURCE_FRAMES * FRAME_SAMPLES * 2, (const char *)src,
+			(char *)g711_sources[0] + s * SOURCE_FRAMES * FRAME_SAMPLES);
+		pcm16_to_ulaw(SOURCE_FRAMES * FRAME_SAMPLES * 2, (const char *)src,
+			(char *)g711_sources[1] + s * SOURCE_FRAMES * FRAME_SAMPLES);
+		free(narrow);
+	}
+	return 0;
+}
+
+/** @brief now in performance counter ticks */
+static LONGLONG now()
+{
+	LARGE_INTEGER count;
+
+	QueryPerformanceCounter(&count);
+	return count.QuadPart;
+}
+
+/** @brief waits until the counter reaches t. Sleeps while more than a
+couple of milliseconds are left and spins for the rest, since Sleep()
+only has scheduler tick resolution. */
+static void wait_until(LONGLONG t, LONGLONG frequency)
+{
+	LONGLONG left;
+
+	for(;;)
+	{
+		left = t - now();
+		if(left <= 0)
+			return;
+		if(left > frequency / 500)
+			Sleep((DWORD)(left * 1000 / frequency) - 1);
+	}
+}
+
+/** @brief copies the next frame of every call into w->in */
+static void gather_frames(struct worker *w)
+{
+	int i;
+	struct call *c;
+	int in_bytes = w->opts->mode == MODE_ENCODE ? pcm_frame * 2 : FRAME_SAMPLES;
+
+	for(i = 0; i < w->count; i++)
+	{
+		c = &w->calls[i];
+		if(w->opts->mode == MODE_ENCODE)
+			memcpy(w->in + i * in_bytes, pcm_sources +
+				(c->source * SOURCE_FRAMES + c->frame) * pcm_frame, in_bytes);
+		else
+			memcpy(w->in + i * in_bytes, g711_sources[c->law] +
+				(c->source * SOURCE_FRAMES + c->frame) * FRAME_SAMPLES, in_bytes);
+		c->frame = (c->frame + 1) % SOURCE_FRAMES;
+	}
+}
+
+/** @brief runs call i's frame through the resampler, returns the
+pcm16 samples it ends up as */
+static int resample_frame(struct worker *w, int i, const short *src, int samples)
+{
+	struct call *c = &w->calls[i];
+	short *dst = w->resampled + i * (pcm_frame + FRAME_SAMPLES + 64);
+
+	if(c->rs.up == 0)
+	{
+		memcpy(dst, src, samples * sizeof(short));
+		return samples;
+	}
+	return resampler_process(&c->rs, src, samples, dst);
+}
+
+/** @brief the signature shared by the conversion kernels */
+typedef void (*kernel)(int, const char *, char *);
+
+/** @brief the kernel turning law into pcm16 */
+static kernel decoder(int law)
+{
+	return law == G711_ALAW ? alaw_to_pcm16 : ulaw_to_pcm16;
+}
+
+/** @brief the kernel turning pcm16 into law */
+static kernel encoder(int law)
+{
+	return law == G711_ALAW ? pcm16_to_alaw : pcm16_to_ulaw;
+}
+
+/** @brief converts the frame of call i on its own */
+static void convert_frame(struct worker *w, int i)
+{
+	struct call *c = &w->calls[i];
+	int stride = pcm_frame + FRAME_SAMPLES + 64;
+	short *pcm = w->pcm + i * stride;
+	short *resampled = w->resampled + i * stride;
+	int n;
+
+	switch(w->opts->mode)
+	{
+	case MODE_TRANSCODE:
+		decoder(c->law)(FRAME_SAMPLES, w->in + i * FRAME_SAMPLES, (char *)pcm);
+		encoder(!c->law)(FRAME_SAMPLES * 2, (const char *)pcm, w->out + i * stride);
+		break;
+	case MODE_DECODE:
+		decoder(c->law)(FRAME_SAMPLES, w->in + i * FRAME_SAMPLES, (char *)pcm);
+		n = resample_frame(w, i, pcm, FRAME_SAMPLES);
+		w->checksum ^= (unsigned short)resampled[n > 0 ? n - 1 : 0];
+		return;
+	case MODE_ENCODE:
+		n = resample_frame(w, i, (const short *)(w->in + i * pcm_frame * 2), pcm_frame);
+		encoder(c->law)(n * 2, (const char *)resampled, w->out + i * stride);
+		break;
+	}
+	w->checksum ^= (unsigned char)w->out[i * stride];
+}
+
+/** @brief converts the frames of all of w's calls with the batch API */
+static void convert_batch(struct worker *w)
+{
+	int stride = pcm_frame + FRAME_SAMPLES + 64;
+	int i, n;
+
+	for(i = 0; i < w->count; i++)
+		w->frames[i].law = w->calls[i].law;
+	switch(w->opts->mode)
+	{
+	case MODE_TRANSCODE:
+		for(i = 0; i < w->count; i++)
+		{
+			w->frames[i].samples = FRAME_SAMPLES;
+			w->frames[i].src = w->in + i * FRAME_SAMPLES;
+			w->frames[i].dst = (char *)(w->pcm + i * stride);
+		}
+		g711_decode_batch(w->frames, w->count);
+		for(i = 0; i < w->count; i++)
+		{
+			w->frames[i].law = !w->calls[i].law;
+			w->frames[i].src = (const char *)(w->pcm + i * stride);
+			w->frames[i].dst = w->out + i * stride;
+		}
+		g711_encode_batch(w->frames, w->count);
+		break;
+	case MODE_DECODE:
+		for(i = 0; i < w->count; i++)
+		{
+			w->frames[i].samples = FRAME_SAMPLES;
+			w->frames[i].src = w->in + i * FRAME_SAMPLES;
+			w->frames[i].dst = (char *)(w->pcm + i * stride);
+		}
+		g711_decode_batch(w->frames, w->count);
+		for(i = 0; i < w->count; i++)
+		{
+			n = resample_frame(w, i, w->pcm + i * stride, FRAME_SAMPLES);
+			w->checksum ^= (unsigned short)w->resampled[i * stride + (n > 0 ? n - 1 : 0)];
+		}
+		return;
+	case MODE_ENCODE:
+		for(i = 0; i < w->count; i++)
+		{
+			w->frames[i].samples = resample_frame(w, i,
+				(const short *)(w->in + i * pcm_frame * 2), pcm_frame);
+			w->frames[i].src = (const char *)(w->resampled + i * stride);
+			w->frames[i].dst = w->out + i * stride;
+		}
+		g711_encode_batch(w->frames, w->count);
+		break;
+	}
+	for(i = 0; i < w->count; i++)
+		w->checksum ^= (unsigned char)w->out[i * stride];
+}
+
+/** @brief adds one frame's latency to the statistics */
+static void record(struct worker *w, LONGLONG due, LONGLONG finished)
+{
+	double us = (double)(finished - due) * 1e6 / (double)w->frequency;
+	long bucket = (long)us;
+
+	if(bucket >= LATENCY_BUCKETS)
+		bucket = LATENCY_BUCKETS - 1;
+	w->histogram[bucket]++;
+	w->done++;
+	if(us > FRAME_MS * 1000.0)
+		w->missed++;
+	if(us > w->worst)
+		w->worst = us;
+}
+
+/** @brief the worker thread: one tick every FRAME_MS until the run ends */
+static DWORD WINAPI worker_thread(LPVOID param)
+{
+	struct worker *w = (struct worker *)param;
+	LONGLONG period = w->frequency * FRAME_MS / 1000;
+	LONGLONG due, finished;
+	int ticks = w->opts->seconds * 1000 / FRAME_MS;
+	int t, i;
+
+	for(t = 0; t < ticks; t++)
+	{
+		/* a thread that has fallen behind starts the next tick late, and
+		the lateness counts against the frames of that tick */
+		due = w->start + t * period;
+		wait_until(due, w->frequency);
+		gather_frames(w);
+		if(w->opts->batch)
+		{
+			convert_batch(w);
+			finished = now();
+			for(i = 0; i < w->count; i++)
+				record(w, due, finished);
+		}
+		else
+		{
+			for(i = 0; i < w->count; i++)
+			{
+				convert_frame(w, i);
+				record(w, due, now());
+			}
+		}
+	}
+	return 0;
+}
+
+/** @brief the latency below which fraction of the frames finished */
+static double percentile(const unsigned long *histogram, unsigned long frames, double fraction)
+{
+	unsigned long target = (unsigned long)(fraction * frames);
+	unsigned long seen = 0;
+	long i;
+
+	for(i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		seen += histogram[i];
+		if(seen > target)
+			return (double)i;
+	}
+	return (double)LATENCY_BUCKETS;
+}
+
+/** @brief frees what setup_workers allocated */
+static void free_workers(struct worker *workers, int threads)
+{
+	int t, i;
+
+	for(t = 0; t < threads; t++)
+	{
+		for(i = 0; i < workers[t].count; i++)
+			resampler_free(&workers[t].calls[i].rs);
+		free(workers[t].calls);
+		free(workers[t].in);
+		free(workers[t].pcm);
+		free(workers[t].resampled);
+		free(workers[t].out);
+		free(workers[t].frames);
+		free(workers[t].histogram);
+	}
+	free(workers);
+}
+
+/** @brief spreads calls over the threads, returns NULL when out of memory
+or a resampler can not be set up */
+static struct worker *setup_workers(const struct load_options *opts, int calls)
+{
+	struct worker *workers;
+	struct worker *w;
+	int stride = pcm_frame + FRAME_SAMPLES + 64;
+	int t, i, n, failed;
+
+	workers = (struct worker *)calloc(opts->threads, sizeof(struct worker));
+	if(workers == NULL)
+		return NULL;
+	for(t = 0; t < opts->threads; t++)
+	{
+		w = &workers[t];
+		w->opts = opts;
+		w->count = calls / opts->threads + (t < calls % opts->threads);
+		n = w->count > 0 ? w->count : 1;
+		w->calls = (struct call *)calloc(n, sizeof(struct call));
+		w->in = (char *)malloc(n * pcm_frame * 2 + n * FRAME_SAMPLES);
+		w->pcm = (short *)malloc(n * stride * sizeof(short));
+		w->resampled = (short *)malloc(n * stride * sizeof(short));
+		w->out = (char *)malloc(n * stride);
+		w->frames = (struct g711_frame *)malloc(n * sizeof(struct g711_frame));
+		w->histogram = (unsigned long *)calloc(LATENCY_BUCKETS, sizeof(unsigned long));
+		if(w->calls == NULL || w->in == NULL || w->pcm == NULL || w->resampled == NULL ||
+			w->out == NULL || w->frames == NULL || w->histogram == NULL)
+		{
+			free_workers(workers, t + 1);
+			return NULL;
+		}
+		for(i = 0; i < w->count; i++)
+		{
+			n = t + i * opts->threads;
+			w->calls[i].law = opts->law >= 0 ? opts->law : n & 1;
+			w->calls[i].source = n % SOURCES;
+			w->calls[i].frame = n % SOURCE_FRAMES;
+			if(opts->rate != G711_RATE)
+			{
+				if(opts->mode == MODE_DECODE)
+					failed = resampler_init(&w->calls[i].rs, G711_RATE, opts->rate, 1);
+				else
+					failed = resampler_init(&w->calls[i].rs, opts->rate, G711_RATE, 1);
+				/* a failed init leaves rs empty, which free_workers skips */
+				if(failed != 0)
+				{
+					free_workers(workers, t + 1);
+					return NULL;
+				}
+			}
+		}
+	}
+	return workers;
+}
+
+/** @brief runs calls for opts->seconds, returns 0 on success */
+static int run_load(const struct load_options *opts, int calls, struct load_result *result)
+{
+	struct worker *workers;
+	HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+	LARGE_INTEGER frequency;
+	LONGLONG start;
+	unsigned long *histogram;
+	int t, i;
+
+	workers = setup_workers(opts, calls);
+	histogram = (unsigned long *)calloc(LATENCY_BUCKETS, sizeof(unsigned long));
+	if(workers == NULL || histogram == NULL)
+	{
+		printf("Error while setting up %d calls.\n", calls);
+		free(histogram);
+		if(workers != NULL)
+			free_workers(workers, opts->threads);
+		return -1;
+	}
+
+	/* every thread's first tick is the same moment, a little ahead so
+	they have all been created by then */
+	QueryPerformanceFrequency(&frequency);
+	start = now() + frequency.QuadPart / 10;
+	for(t = 0; t < opts->threads; t++)
+	{
+		workers[t].frequency = frequency.QuadPart;
+		workers[t].start = start;
+		threads[t] = CreateThread(NULL, 0, worker_thread, &workers[t], 0, NULL);
+		if(threads[t] == NULL)
+		{
+			printf("Error while creating thread %d.\n", t);
+			exit(EXIT_FAILURE);
+		}
+	}
+	WaitForMultipleObjects(opts->threads, threads, TRUE, INFINITE);
+
+	memset(result, 0, sizeof(*result));
+	for(t = 0; t < opts->threads; t++)
+	{
+		CloseHandle(threads[t]);
+		for(i = 0; i < LATENCY_BUCKETS; i++)
+			histogram[i] += workers[t].histogram[i];
+		result->frames += workers[t].done;
+		result->missed += workers[t].missed;
+		if(workers[t].worst > result->worst)
+			result->worst = workers[t].worst;
+	}
+	result->p50 = percentile(histogram, result->frames, 0.5);
+	result->p99 = percentile(histogram, result->frames, 0.99);
+	result->p999 = percentile(histogram, result->frames, 0.999);
+
+	free(histogram);
+	free_workers(workers, opts->threads);
+	return 0;
+}
+
+/** @brief prints one run's results */
+static void print_result(int calls, const struct load_result *r)
+{
+	printf("%6d calls: %lu frames, %lu missed (%.3f%%), latency us p50 %.0f p99 %.0f p99.9 %.0f max %.0f\n",
+		calls, r->frames, r->missed, r->frames ? 100.0 * r->missed / r->frames : 0.0,
+		r->p50, r->p99, r->p999, r->worst);
+}
+
+/** @brief whether a run kept up with real time */
+static int sustainable(const struct load_result *r)
+{
+	return r->missed <= SUSTAINABLE_MISSES * r->frames;
+}
+
+/** @brief the main function, takes Unicode arguments. */
+int wmain(int argc, wchar_t *argv[])
+{
+	struct load_options opts;
+	struct load_result result;
+	int good, bad, calls;
+	static const char *modes[] = { "transcode", "decode", "encode" };
+
+	if(argc < 2 || parse_options(argc, argv, &opts) != 0)
+	{
+		printf("Incorrect parameters.\n");
+		print_usage("BBBG711Load");
+		exit(EXIT_FAILURE);
+	}
+
+	pcm16_alaw_tableinit();
+	pcm16_ulaw_tableinit();
+	alaw_pcm16_tableinit();
+	ulaw_pcm16_tableinit();
+	if(opts.autotune)
+		g711_autotune(FRAME_SAMPLES);
+	g711_print_kernels();
+	if(make_sources(opts.rate) != 0)
+	{
+		printf("Error while allocating memory for the synthetic audio.\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("%s, %s, %d samples/second pcm, %d threads, %d s per run%s\n",
+		modes[opts.mode], opts.law == G711_ALAW ? "A-law" : opts.law == G711_ULAW ?
+		"u-law" : "mixed laws", opts.rate, opts.threads, opts.seconds,
+		opts.batch ? ", batched" : "");
+
+	if(!opts.sweep)
+	{
+		if(run_load(&opts, opts.calls, &result) != 0)
+			exit(EXIT_FAILURE);
+		print_result(opts.calls, &result);
+		return sustainable(&result) ? 0 : 1;
+	}
+
+	/* double until a run falls behind, then bisect */
+	good = 0;
+	bad = 0;
+	calls = opts.calls;
+	while(bad == 0)
+	{
+		if(run_load(&opts, calls, &result) != 0)
+			bad = calls;
+		else
+		{
+			print_result(calls, &result);
+			if(sustainable(&result))
+				good = calls;
+			else
+				bad = calls;
+		}
+		if(calls > 0x3FFFFFFF / 2)
+			break;
+		calls *= 2;
+	}
+	while(bad - good > 1 && bad - good > good / 50)
+	{
+		calls = good + (bad - good) / 2;
+		if(run_load(&opts, calls, &result) != 0)
+		{
+			bad = calls;
+			continue;
+		}
+		print_result(calls, &result);
+		if(sustainable(&result))
+			good = calls;
+		else
+			bad = calls;
+	}
+	printf("max sustainable calls: %d\n", good);
+	return 0;
+}
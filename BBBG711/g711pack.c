@@ -0,0 +1,984 @@
+/** @file g711pack.c
+
+	@brief Lossless compression of G711 recordings, in the manner of
+	ITU-T G.711.0.
+
+	File layout, all numbers little endian:
+	  header   "G711PACK", version u16, format tag u16, channels u16,
+	           0 u16, frequency u32, samples per frame u32
+	  frames   "FR", samples per channel u16, payload bytes u32, payload
+	  index    "IX", tail bytes u16, frame count u32, tail, frame
+	           offsets u64 each
+	  trailer  index offset u64, samples per channel u64, "G711PACK"
+
+	The tail holds the bytes after the last sample of every channel,
+	as they were, so input cut short between channels still comes
+	back byte for byte. Files without one have 0 tail bytes.
+
+	A payload holds one subframe per channel, bit packed MSB first and
+	padded to a byte at the end of the frame. A subframe is a 2 bit
+	type followed by
+	  constant  the value, 8 bits
+	  verbatim  every value, 8 bits each
+	  fixed     order 2 bits, warmup values, residual
+	  lpc       order-1 3 bits, shift 4 bits, 12 bit coefficients,
+	            warmup values, residual
+	Values are amplitude positions plus 128. The residual comes in
+	partitions of PARTITION samples (the first one short by the order),
+	each a 4 bit Rice parameter and Rice codes, or 15, a 5 bit width
+	and the zigzagged residuals in that many bits.
+*/
+#include "stdafx.h"
+#include <math.h>
+#include "wavfile.h"
+#include "g711pack.h"
+
+/** @brief first and last 8 bytes of a packed file */
+#define PACK_MAGIC "G711PACK"
+/** @brief bumped when the layout changes */
+#define PACK_VERSION 1
+/** @brief bytes in the file header */
+#define HEADER_SIZE 24
+/** @brief bytes in a frame header */
+#define FRAME_HEADER_SIZE 8
+/** @brief bytes in the trailer */
+#define TRAILER_SIZE 24
+/** @brief highest LPC order tried */
+#define MAX_ORDER 8
+/** @brief highest fixed predictor order */
+#define MAX_FIXED 3
+/** @brief bits in each quantised LPC coefficient */
+#define COEFF_BITS 12
+/** @brief samples in a Rice partition */
+#define PARTITION 256
+/** @brief Rice parameter that says the partition is stored raw */
+#define ESCAPE 15
+/** @brief frames each encoder thread takes per batch */
+#define FRAMES_PER_JOB 16
+
+/** @brief subframe types */
+enum { SUB_CONSTANT, SUB_VERBATIM, SUB_FIXED, SUB_LPC };
+
+/** @brief amplitude position of each code, [0] A-law, [1] u-law */
+static signed char code_index[2][256];
+/** @brief code at each amplitude position + 128 */
+static unsigned char index_code[2][256];
+
+/** @brief coefficients of the fixed predictors */
+static const int fixed_coeffs[MAX_FIXED + 1][MAX_FIXED] = {
+	{ 0, 0, 0 }, { 1, 0, 0 }, { 2, -1, 0 }, { 3, -3, 1 } };
+
+/** @brief the coding chosen for one channel of one frame */
+struct subframe {
+	int type;
+	int order;
+	int shift;
+	int coeffs[MAX_ORDER];
+};
+
+/** @brief bit packing, MSB first */
+struct bitwriter {
+	unsigned char *p;
+	uint32_t acc;
+	int bits;
+};
+
+/** @brief bit unpacking, MSB first. Reading past the end gives zeros
+and sets overrun. */
+struct bitreader {
+	const unsigned char *p;
+	const unsigned char *end;
+	uint32_t acc;
+	int bits;
+	int overrun;
+};
+
+/** @brief one frame for the encoder threads */
+struct pack_frame {
+	/** @brief interleaved codes */
+	const unsigned char *src;
+	/** @brief samples per channel */
+	int samples;
+	/** @brief packed payload */
+	unsigned char *dst;
+	/** @brief bytes in the payload */
+	int bytes;
+};
+
+/** @brief the frames one encoder thread packs, and its scratch space */
+struct pack_job {
+	struct pack_frame *frames;
+	int count;
+	int law;
+	int channels;
+	int *x;
+	uint32_t *u;
+};
+
+/** @brief builds the code <-> amplitude position maps. A-law codes
+are sign and magnitude after the even bits are flipped, u-law codes
+after all bits are; either way the magnitude bits rise with the
+amplitude. */
+static void build_maps()
+{
+	static int built;
+	int c, v;
+
+	if(built)
+		return;
+	for(c = 0; c < 256; c++)
+	{
+		v = c ^ 0x55;
+		code_index[0][c] = (signed char)((v & 0x80) ? (v & 0x7F) : -(v & 0x7F) - 1);
+		v = ~c & 0xFF;
+		code_index[1][c] = (signed char)((v & 0x80) ? -(v & 0x7F) - 1 : (v & 0x7F));
+	}
+	for(c = 0; c < 256; c++)
+	{
+		index_code[0][code_index[0][c] + 128] = (unsigned char)c;
+		index_code[1][code_index[1][c] + 128] = (unsigned char)c;
+	}
+	built = 1;
+}
+
+static void put_le(unsigned char *p, uint64_t v, int bytes)
+{
+	int i;
+
+	for(i = 0; i < bytes; i++)
+		p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint64_t get_le(const unsigned char *p, int bytes)
+{
+	uint64_t v = 0;
+	int i;
+
+	for(i = bytes - 1; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+/** @brief writes the low n bits of v, n at most 24 */
+static void put_bits(struct bitwriter *w, uint32_t v, int n)
+{
+	w->acc = (w->acc << n) | (v & ((1UL << n) - 1));
+	w->bits += n;
+	while(w->bits >= 8)
+	{
+		w->bits -= 8;
+		*w->p++ = (unsigned char)(w->acc >> w->bits);
+	}
+}
+
+/** @brief writes the low n bits of v, n up to 32 */
+static void put_long(struct bitwriter *w, uint32_t v, int n)
+{
+	if(n > 16)
+	{
+		put_bits(w, v >> 16, n - 16);
+		n = 16;
+	}
+	put_bits(w, v, n);
+}
+
+/** @brief reads n bits, n at most 24 */
+static uint32_t get_bits(struct bitreader *r, int n)
+{
+	while(r->bits < n)
+	{
+		r->acc <<= 8;
+		if(r->p < r->end)
+			r->acc |= *r->p++;
+		else
+			r->overrun = 1;
+		r->bits += 8;
+	}
+	r->bits -= n;
+	return (r->acc >> r->bits) & ((1UL << n) - 1);
+}
+
+/** @brief reads n bits, n up to 32 */
+static uint32_t get_long(struct bitreader *r, int n)
+{
+	uint32_t hi = 0;
+
+	if(n > 16)
+	{
+		hi = get_bits(r, n - 16) << 16;
+		n = 16;
+	}
+	return hi | get_bits(r, n);
+}
+
+/** @brief reads a run of zeros ended by a one, returns its length */
+static uint32_t get_unary(struct bitreader *r)
+{
+	uint32_t q = 0;
+
+	for(;;)
+	{
+		if(r->bits == 0)
+		{
+			if(r->p >= r->end)
+			{
+				r->overrun = 1;
+				return q;
+			}
+			r->acc = (r->acc << 8) | *r->p++;
+			r->bits = 8;
+		}
+		if((r->acc & ((1UL << r->bits) - 1)) == 0)
+		{
+			/* nothing but zeros left in the accumulator */
+			q += r->bits;
+			r->bits = 0;
+			continue;
+		}
+		while(!((r->acc >> (r->bits - 1)) & 1))
+		{
+			q++;
+			r->bits--;
+		}
+		r->bits--;
+		return q;
+	}
+}
+
+/** @brief folds a signed residual to unsigned, 0 -1 1 -2 ... */
+static uint32_t zigzag(int r)
+{
+	return r >= 0 ? (uint32_t)r << 1 : ((uint32_t)(-(r + 1)) << 1) | 1;
+}
+
+static int bit_width(uint32_t u)
+{
+	int w = 0;
+
+	while(u)
+	{
+		w++;
+		u >>= 1;
+	}
+	return w;
+}
+
+/** @brief the cheapest coding of one partition. param is the Rice
+parameter, or ESCAPE | width << 4. returns the bits it takes. */
+static uint32_t partition_bits(const uint32_t *u, int n, int *param)
+{
+	uint64_t sum = 0;
+	uint64_t bits, best;
+	uint32_t max = 0;
+	int i, k, k0, width;
+
+	for(i = 0; i < n; i++)
+	{
+		sum += u[i];
+		if(u[i] > max)
+			max = u[i];
+	}
+	width = bit_width(max);
+	best = 4 + 5 + (uint64_t)n * width;
+	*param = ESCAPE | width << 4;
+
+	/* the best parameter is about log2 of the mean */
+	for(k0 = 0; k0 < ESCAPE - 1 && ((uint64_t)n << (k0 + 1)) <= sum; k0++)
+		;
+	for(k = k0 > 0 ? k0 - 1 : 0; k <= k0 + 1 && k < ESCAPE; k++)
+	{
+		bits = 4 + (uint64_t)n * (k + 1);
+		for(i = 0; i < n; i++)
+			bits += u[i] >> k;
+		if(bits < best)
+		{
+			best = bits;
+			*param = k;
+		}
+	}
+	return (uint32_t)best;
+}
+
+/** @brief the partition holding samples [start, end) */
+static void partition_range(int p, int n, int order, int *start, int *end)
+{
+	*start = p * PARTITION;
+	*end = *start + PARTITION < n ? *start + PARTITION : n;
+	if(p == 0)
+		*start = order < *end ? order : *end;
+}
+
+/** @brief bits for the residual u[order..n-1], choosing params */
+static uint32_t residual_bits(const uint32_t *u, int n, int order, int *params)
+{
+	int p, start, end;
+	uint32_t bits = 0;
+
+	for(p = 0; p * PARTITION < n; p++)
+	{
+		partition_range(p, n, order, &start, &end);
+		bits += partition_bits(u + start, end - start, &params[p]);
+	}
+	return bits;
+}
+
+/** @brief zigzagged residual of predicting x with s, from s->order on */
+static void predict(const int *x, int n, const struct subframe *s, uint32_t *u)
+{
+	int i, j;
+	long sum;
+
+	for(i = s->order; i < n; i++)
+	{
+		sum = 0;
+		for(j = 0; j < s->order; j++)
+			sum += (long)s->coeffs[j] * x[i - 1 - j];
+		u[i] = zigzag(x[i] - (int)(sum >> s->shift));
+	}
+}
+
+/** @brief LPC coefficients for orders 1..MAX_ORDER by Levinson-Durbin
+on the Welch windowed autocorrelation. lpc[o - 1] predicts with order
+o. returns the highest order found, 0 if the signal is silent. */
+static int lpc_analysis(const int *x, int n, double lpc[MAX_ORDER][MAX_ORDER])
+{
+	double autoc[MAX_ORDER + 1];
+	double a[MAX_ORDER];
+	double w, err, r, tmp, half = (n - 1) / 2.0;
+	double *xw = (double *)malloc(n * sizeof(double));
+	int i, j, lag;
+
+	if(xw == NULL)
+		return 0;
+	for(i = 0; i < n; i++)
+	{
+		w = (i - half) / (half + 1.0);
+		xw[i] = x[i] * (1.0 - w * w);
+	}
+	for(lag = 0; lag <= MAX_ORDER; lag++)
+	{
+		autoc[lag] = 0.0;
+		for(i = lag; i < n; i++)
+			autoc[lag] += xw[i] * xw[i - lag];
+	}
+	free(xw);
+
+	err = autoc[0];
+	if(err <= 0.0)
+		return 0;
+	for(i = 0; i < MAX_ORDER; i++)
+	{
+		r = -autoc[i + 1];
+		for(j = 0; j < i; j++)
+			r -= a[j] * autoc[i - j];
+		r /= err;
+		a[i] = r;
+		for(j = 0; j < (i >> 1); j++)
+		{
+			tmp = a[j];
+			a[j] += r * a[i - 1 - j];
+			a[i - 1 - j] += r * tmp;
+		}
+		if(i & 1)
+			a[j] += a[j] * r;
+		err *= 1.0 - r * r;
+		for(j = 0; j <= i; j++)
+			lpc[i][j] = -a[j];
+		if(err <= 0.0)
+			return i + 1;
+	}
+	return MAX_ORDER;
+}
+
+/** @brief quantises order coefficients to COEFF_BITS with the largest
+shift that fits. returns 0 on success */
+static int quantize(const double *lpc, int order, struct subframe *s)
+{
+	double cmax = 0.0;
+	double limit = (1 << (COEFF_BITS - 1)) - 1;
+	int j, q;
+
+	for(j = 0; j < order; j++)
+		if(fabs(lpc[j]) > cmax)
+			cmax = fabs(lpc[j]);
+	if(cmax <= 0.0 || cmax > limit)
+		return -1;
+	for(s->shift = 15; s->shift > 0 && cmax * (1 << s->shift) > limit; s->shift--)
+		;
+	for(j = 0; j < order; j++)
+	{
+		q = (int)floor(lpc[j] * (1 << s->shift) + 0.5);
+		if(q > limit)
+			q = (int)limit;
+		if(q < -limit - 1)
+			q = (int)-limit - 1;
+		s->coeffs[j] = q;
+	}
+	s->type = SUB_LPC;
+	s->order = order;
+	return 0;
+}
+
+/** @brief codes one channel of one frame in the fewest bits */
+static void encode_channel(struct bitwriter *w, const int *x, int n, uint32_t *u)
+{
+	struct subframe best, s;
+	uint32_t best_bits, bits;
+	int params[(G711PACK_FRAME + PARTITION - 1) / PARTITION];
+	double lpc[MAX_ORDER][MAX_ORDER];
+	int i, order, orders, start, end, p;
+
+	for(i = 1; i < n && x[i] == x[0]; i++)
+		;
+	if(i == n)
+	{
+		put_bits(w, SUB_CONSTANT, 2);
+		put_bits(w, x[0] + 128, 8);
+		return;
+	}
+
+	memset(&best, 0, sizeof(best));
+	best.type = SUB_VERBATIM;
+	best_bits = 2 + 8 * n;
+	memset(&s, 0, sizeof(s));
+	for(order = 0; order <= MAX_FIXED && order < n; order++)
+	{
+		s.type = SUB_FIXED;
+		s.order = order;
+		s.shift = 0;
+		memcpy(s.coeffs, fixed_coeffs[order], sizeof(fixed_coeffs[order]));
+		predict(x, n, &s, u);
+		bits = 2 + 2 + 8 * order + residual_bits(u, n, order, params);
+		if(bits < best_bits)
+		{
+			best = s;
+			best_bits = bits;
+		}
+	}
+	orders = n > 4 * MAX_ORDER ? lpc_analysis(x, n, lpc) : 0;
+	for(order = 1; order <= orders; order++)
+	{
+		if(quantize(lpc[order - 1], order, &s) != 0)
+			continue;
+		predict(x, n, &s, u);
+		bits = 2 + 3 + 4 + (COEFF_BITS + 8) * order + residual_bits(u, n, order, params);
+		if(bits < best_bits)
+		{
+			best = s;
+			best_bits = bits;
+		}
+	}
+
+	put_bits(w, best.type, 2);
+	if(best.type == SUB_VERBATIM)
+	{
+		for(i = 0; i < n; i++)
+			put_bits(w, x[i] + 128, 8);
+		return;
+	}
+	if(best.type == SUB_FIXED)
+		put_bits(w, best.order, 2);
+	else
+	{
+		put_bits(w, best.order - 1, 3);
+		put_bits(w, best.shift, 4);
+		for(i = 0; i < best.order; i++)
+			put_bits(w, best.coeffs[i], COEFF_BITS);
+	}
+	for(i = 0; i < best.order; i++)
+		put_bits(w, x[i] + 128, 8);
+	predict(x, n, &best, u);
+	residual_bits(u, n, best.order, params);
+	for(p = 0; p * PARTITION < n; p++)
+	{
+		partition_range(p, n, best.order, &start, &end);
+		if((params[p] & 15) == ESCAPE)
+		{
+			put_bits(w, ESCAPE, 4);
+			put_bits(w, params[p] >> 4, 5);
+			for(i = start; i < end; i++)
+				put_long(w, u[i], params[p] >> 4);
+			continue;
+		}
+		put_bits(w, params[p], 4);
+		for(i = start; i < end; i++)
+		{
+			/* unary quotient as zeros and a one, then k remainder bits */
+			uint32_t q = u[i] >> params[p];
+
+			while(q > 16)
+			{
+				put_bits(w, 0, 16);
+				q -= 16;
+			}
+			put_bits(w, 1, q + 1);
+			put_bits(w, u[i], params[p]);
+		}
+	}
+}
+
+/** @brief packs one frame, returns the payload bytes */
+static int encode_frame(const struct pack_job *job, const struct pack_frame *f)
+{
+	struct bitwriter w;
+	int c, i;
+
+	w.p = f->dst;
+	w.acc = 0;
+	w.bits = 0;
+	for(c = 0; c < job->channels; c++)
+	{
+		for(i = 0; i < f->samples; i++)
+			job->x[i] = code_index[job->law][f->src[i * job->channels + c]];
+		encode_channel(&w, job->x, f->samples, job->u);
+	}
+	if(w.bits > 0)
+		put_bits(&w, 0, 8 - w.bits);
+	return (int)(w.p - f->dst);
+}
+
+/** @brief encoder thread: packs the frames of one job */
+static DWORD WINAPI pack_worker(LPVOID param)
+{
+	struct pack_job *job = (struct pack_job *)param;
+	int i;
+
+	for(i = 0; i < job->count; i++)
+		job->frames[i].bytes = encode_frame(job, &job->frames[i]);
+	return 0;
+}
+
+/** @brief largest payload a frame of samples can take: verbatim plus
+the type bits, rounded up */
+static int payload_bound(int channels, int samples)
+{
+	return channels * (samples + 1) + 1;
+}
+
+/** @brief packs the G711 audio in at its data chunk into out, with
+threads encoder threads. The input is read until fmt->data_bytes run
+out or, for a stream of unknown length, until it ends. The output
+need not seek. returns 0 on success */
+int g711pack_encode(FILE *in, const struct wav_format *fmt, FILE *out, int threads, uint64_t *packed_bytes)
+{
+	unsigned char head[HEADER_SIZE > TRAILER_SIZE ? HEADER_SIZE : TRAILER_SIZE];
+	int channels = fmt->nChannels;
+	int frame_bytes = G711PACK_FRAME * channels;
+	int bound = payload_bound(channels, G711PACK_FRAME);
+	int batch, count, per, i, t, result = -1;
+	size_t want, got, tail = 0;
+	uint64_t remaining = fmt->data_bytes;
+	uint64_t pos = HEADER_SIZE, samples = 0;
+	uint64_t *index = NULL, *grown;
+	uint32_t frames = 0, capacity = 0;
+	unsigned char *input = NULL, *output = NULL, *tail_src = NULL;
+	struct pack_frame *pf = NULL;
+	struct pack_job *jobs = NULL;
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+
+	if(channels == 0 || (fmt->formattag != WAVE_FORMAT_ALAW && fmt->formattag != WAVE_FORMAT_MULAW))
+		return -1;
+	if(threads < 1)
+		threads = 1;
+	if(threads > MAXIMUM_WAIT_OBJECTS)
+		threads = MAXIMUM_WAIT_OBJECTS;
+	build_maps();
+
+	batch = threads * FRAMES_PER_JOB;
+	input = (unsigned char *)malloc((size_t)batch * frame_bytes);
+	output = (unsigned char *)malloc((size_t)batch * bound);
+	pf = (struct pack_frame *)calloc(batch, sizeof(struct pack_frame));
+	jobs = (struct pack_job *)calloc(threads, sizeof(struct pack_job));
+	if(input == NULL || output == NULL || pf == NULL || jobs == NULL)
+		goto done;
+	for(t = 0; t < threads; t++)
+	{
+		jobs[t].law = fmt->formattag == WAVE_FORMAT_MULAW;
+		jobs[t].channels = channels;
+		jobs[t].x = (int *)malloc(G711PACK_FRAME * sizeof(int));
+		jobs[t].u = (uint32_t *)malloc(G711PACK_FRAME * sizeof(uint32_t));
+		if(jobs[t].x == NULL || jobs[t].u == NULL)
+			goto done;
+	}
+
+	memcpy(head, PACK_MAGIC, 8);
+	put_le(head + 8, PACK_VERSION, 2);
+	put_le(head + 10, fmt->formattag, 2);
+	put_le(head + 12, channels, 2);
+	put_le(head + 14, 0, 2);
+	put_le(head + 16, fmt->frequency, 4);
+	put_le(head + 20, G711PACK_FRAME, 4);
+	if(fwrite(head, 1, HEADER_SIZE, out) != HEADER_SIZE)
+		goto done;
+
+	while(remaining > 0)
+	{
+		want = (size_t)batch * frame_bytes;
+		if(remaining < want)
+			want = (size_t)remaining;
+		got = fread(input, 1, want, in);
+		/* a part sample can only come at the end, keep it for the index */
+		tail = got % channels;
+		got -= tail;
+		tail_src = input + got;
+		if(got == 0)
+			break;
+
+		/* cut the batch into frames and share them out */
+		count = (int)((got + frame_bytes - 1) / frame_bytes);
+		for(i = 0; i < count; i++)
+		{
+			pf[i].src = input + (size_t)i * frame_bytes;
+			pf[i].samples = (int)((got - (size_t)i * frame_bytes) / channels);
+			if(pf[i].samples > G711PACK_FRAME)
+				pf[i].samples = G711PACK_FRAME;
+			pf[i].dst = output + (size_t)i * bound;
+		}
+		per = (count + threads - 1) / threads;
+		for(t = 0; t < threads; t++)
+		{
+			jobs[t].frames = pf + t * per;
+			jobs[t].count = count - t * per < per ? count - t * per : per;
+			if(jobs[t].count < 0)
+				jobs[t].count = 0;
+		}
+		if(threads == 1 || count == 1)
+		{
+			jobs[0].count = count;
+			pack_worker(&jobs[0]);
+		}
+		else
+		{
+			for(t = 0; t < threads; t++)
+			{
+				handles[t] = CreateThread(NULL, 0, pack_worker, &jobs[t], 0, NULL);
+				if(handles[t] == NULL)
+				{
+					/* no thread, do the job here */
+					pack_worker(&jobs[t]);
+				}
+			}
+			for(t = 0; t < threads; t++)
+			{
+				if(handles[t] != NULL)
+				{
+					WaitForSingleObject(handles[t], INFINITE);
+					CloseHandle(handles[t]);
+				}
+			}
+		}
+
+		/* frames go out in order, whichever thread packed them */
+		for(i = 0; i < count; i++)
+		{
+			if(frames == capacity)
+			{
+				capacity = capacity ? capacity * 2 : 1024;
+				grown = (uint64_t *)realloc(index, capacity * sizeof(uint64_t));
+				if(grown == NULL)
+					goto done;
+				index = grown;
+			}
+			index[frames++] = pos;
+			head[0] = 'F';
+			head[1] = 'R';
+			put_le(head + 2, pf[i].samples, 2);
+			put_le(head + 4, pf[i].bytes, 4);
+			if(fwrite(head, 1, FRAME_HEADER_SIZE, out) != FRAME_HEADER_SIZE ||
+				fwrite(pf[i].dst, 1, pf[i].bytes, out) != (size_t)pf[i].bytes)
+				goto done;
+			pos += FRAME_HEADER_SIZE + pf[i].bytes;
+			samples += pf[i].samples;
+		}
+		if(fmt->data_bytes != WAV_SIZE_UNKNOWN)
+			remaining -= got;
+		if(got < want)
+			break;
+	}
+
+	/* index and trailer */
+	head[0] = 'I';
+	head[1] = 'X';
+	put_le(head + 2, tail, 2);
+	put_le(head + 4, frames, 4);
+	if(fwrite(head, 1, 8, out) != 8 || (tail > 0 && fwrite(tail_src, 1, tail, out) != tail))
+		goto done;
+	for(i = 0; i < (int)frames; i++)
+	{
+		put_le(head, index[i], 8);
+		if(fwrite(head, 1, 8, out) != 8)
+			goto done;
+	}
+	put_le(head, pos, 8);
+	put_le(head + 8, samples, 8);
+	memcpy(head + 16, PACK_MAGIC, 8);
+	if(fwrite(head, 1, TRAILER_SIZE, out) != TRAILER_SIZE)
+		goto done;
+	if(packed_bytes != NULL)
+		*packed_bytes = pos + 8 + tail + 8 * (uint64_t)frames + TRAILER_SIZE;
+	result = 0;
+
+done:
+	if(jobs != NULL)
+	{
+		for(t = 0; t < threads; t++)
+		{
+			free(jobs[t].x);
+			free(jobs[t].u);
+		}
+	}
+	free(jobs);
+	free(pf);
+	free(output);
+	free(input);
+	free(index);
+	return result;
+}
+
+/** @brief reads the index through the trailer, then goes back to the
+first frame. The index must end where the trailer starts, and the frame
+offsets must rise by at least a frame header each, so a damaged count
+or offset is caught before anything is allocated or sought. returns 0
+on success, -1 if the file can not seek or has no usable index, and
+leaves the file where it was in that case */
+static int read_index(struct g711pack_reader *r)
+{
+	unsigned char buf[TRAILER_SIZE], check[TRAILER_SIZE];
+	uint64_t index_offset, prev;
+	uint32_t i;
+
+	if(fseek(r->f, -TRAILER_SIZE, SEEK_END) != 0)
+		return -1;
+	if(fread(buf, 1, TRAILER_SIZE, r->f) != TRAILER_SIZE || memcmp(buf + 16, PACK_MAGIC, 8) != 0)
+		goto rewind;
+	index_offset = get_le(buf, 8);
+	if(index_offset < HEADER_SIZE ||
+		fseek(r->f, 0L, SEEK_SET) != 0 || wav_skip(r->f, index_offset) != 0 ||
+		fread(check, 1, 8, r->f) != 8 || check[0] != 'I' || check[1] != 'X')
+		goto rewind;
+	r->tail_bytes = (uint16_t)get_le(check + 2, 2);
+	r->frames = (uint32_t)get_le(check + 4, 4);
+	if(r->tail_bytes >= r->nChannels || r->frames >= (size_t)-1 / sizeof(uint64_t))
+		goto rewind;
+	/* the tail and frames * 8 bytes on must be the trailer, and nothing
+	after it */
+	if(wav_skip(r->f, r->tail_bytes + 8 * (uint64_t)r->frames) != 0 ||
+		fread(check, 1, TRAILER_SIZE, r->f) != TRAILER_SIZE ||
+		memcmp(check, buf, TRAILER_SIZE) != 0 || fgetc(r->f) != EOF)
+		goto rewind;
+	if(fseek(r->f, 0L, SEEK_SET) != 0 || wav_skip(r->f, index_offset + 8) != 0 ||
+		fread(r->tail, 1, r->tail_bytes, r->f) != r->tail_bytes)
+		goto rewind;
+	r->index = (uint64_t *)malloc((r->frames + (size_t)1) * sizeof(uint64_t));
+	if(r->index == NULL)
+		goto rewind;
+	prev = HEADER_SIZE;
+	for(i = 0; i < r->frames; i++)
+	{
+		if(fread(buf, 1, 8, r->f) != 8)
+			goto rewind;
+		r->index[i] = get_le(buf, 8);
+		if(r->index[i] < prev)
+			goto rewind;
+		prev = r->index[i] + FRAME_HEADER_SIZE;
+	}
+	/* one past the last frame is where the index starts */
+	if(index_offset < prev)
+		goto rewind;
+	r->index[r->frames] = index_offset;
+	r->samples = get_le(check + 8, 8);
+	r->indexed = 1;
+rewind:
+	if(!r->indexed)
+	{
+		free(r->index);
+		r->index = NULL;
+		r->frames = 0;
+		r->tail_bytes = 0;
+	}
+	if(fseek(r->f, HEADER_SIZE, SEEK_SET) != 0)
+		return -1;
+	return r->indexed ? 0 : -1;
+}
+
+/** @brief reads the header of a packed file, and its index when the
+file can seek. Prints nothing, as stdout may carry the audio. returns
+0 on success, else G711PACK_NOT_PACKED, G711PACK_UNSUPPORTED or
+G711PACK_NO_MEMORY */
+int g711pack_open(FILE *f, struct g711pack_reader *r)
+{
+	unsigned char head[HEADER_SIZE];
+
+	memset(r, 0, sizeof(*r));
+	r->f = f;
+	build_maps();
+	if(fread(head, 1, HEADER_SIZE, f) != HEADER_SIZE || memcmp(head, PACK_MAGIC, 8) != 0 ||
+		get_le(head + 8, 2) != PACK_VERSION)
+		return G711PACK_NOT_PACKED;
+	r->formattag = (uint16_t)get_le(head + 10, 2);
+	r->nChannels = (uint16_t)get_le(head + 12, 2);
+	r->frequency = (uint32_t)get_le(head + 16, 4);
+	r->frame_samples = (uint32_t)get_le(head + 20, 4);
+	if((r->formattag != WAVE_FORMAT_ALAW && r->formattag != WAVE_FORMAT_MULAW) ||
+		r->nChannels == 0 || r->frame_samples == 0 || r->frame_samples > 65535)
+		return G711PACK_UNSUPPORTED;
+	r->payload = (unsigned char *)malloc(payload_bound(r->nChannels, r->frame_samples));
+	r->x = (int *)malloc(r->frame_samples * sizeof(int));
+	r->tail = (unsigned char *)malloc(r->nChannels);
+	if(r->payload == NULL || r->x == NULL || r->tail == NULL)
+	{
+		g711pack_close(r);
+		return G711PACK_NO_MEMORY;
+	}
+	/* without an index (a pipe) the frames are still read in order */
+	read_index(r);
+	return 0;
+}
+
+/** @brief decodes one channel of n samples into x. returns 0 on success */
+static int decode_channel(struct bitreader *b, int *x, int n)
+{
+	struct subframe s;
+	int i, j, p, start, end, k;
+	uint32_t u;
+	long sum;
+
+	memset(&s, 0, sizeof(s));
+	s.type = get_bits(b, 2);
+	if(s.type == SUB_CONSTANT)
+	{
+		x[0] = (int)get_bits(b, 8) - 128;
+		for(i = 1; i < n; i++)
+			x[i] = x[0];
+		return 0;
+	}
+	if(s.type == SUB_VERBATIM)
+	{
+		for(i = 0; i < n; i++)
+			x[i] = (int)get_bits(b, 8) - 128;
+		return 0;
+	}
+	if(s.type == SUB_FIXED)
+	{
+		s.order = get_bits(b, 2);
+		memcpy(s.coeffs, fixed_coeffs[s.order], sizeof(fixed_coeffs[s.order]));
+	}
+	else
+	{
+		s.order = get_bits(b, 3) + 1;
+		s.shift = get_bits(b, 4);
+		for(i = 0; i < s.order; i++)
+		{
+			s.coeffs[i] = get_bits(b, COEFF_BITS);
+			if(s.coeffs[i] & (1 << (COEFF_BITS - 1)))
+				s.coeffs[i] -= 1 << COEFF_BITS;
+		}
+	}
+	if(s.order >= n)
+		return -1;
+	for(i = 0; i < s.order; i++)
+		x[i] = (int)get_bits(b, 8) - 128;
+
+	/* the residuals first, then the prediction added in place */
+	for(p = 0; p * PARTITION < n; p++)
+	{
+		partition_range(p, n, s.order, &start, &end);
+		k = get_bits(b, 4);
+		if(k == ESCAPE)
+		{
+			k = get_bits(b, 5);
+			for(i = start; i < end; i++)
+			{
+				u = get_long(b, k);
+				x[i] = (int)(u >> 1) ^ -(int)(u & 1);
+			}
+			continue;
+		}
+		for(i = start; i < end; i++)
+		{
+			u = get_unary(b) << k;
+			u |= get_bits(b, k);
+			x[i] = (int)(u >> 1) ^ -(int)(u & 1);
+		}
+	}
+	for(i = s.order; i < n; i++)
+	{
+		sum = 0;
+		for(j = 0; j < s.order; j++)
+			sum += (long)s.coeffs[j] * x[i - 1 - j];
+		x[i] += (int)(sum >> s.shift);
+		if(x[i] < -128 || x[i] > 127)
+			return -1;
+	}
+	return 0;
+}
+
+/** @brief decodes the next frame into dst as interleaved G711 codes.
+At the index it reads the tail into r->tail. returns the samples per
+channel, 0 at the end, -1 if the file is damaged */
+int g711pack_read_frame(struct g711pack_reader *r, unsigned char *dst)
+{
+	unsigned char head[FRAME_HEADER_SIZE];
+	struct bitreader b;
+	const unsigned char *map = index_code[r->formattag == WAVE_FORMAT_MULAW];
+	size_t got;
+	int samples, bytes, c, i;
+
+	got = fread(head, 1, FRAME_HEADER_SIZE, r->f);
+	if(got == 0)
+		return 0;
+	if(got == FRAME_HEADER_SIZE && head[0] == 'I' && head[1] == 'X')
+	{
+		r->tail_bytes = (uint16_t)get_le(head + 2, 2);
+		if(r->tail_bytes >= r->nChannels ||
+			fread(r->tail, 1, r->tail_bytes, r->f) != r->tail_bytes)
+			return -1;
+		return 0;
+	}
+	if(got != FRAME_HEADER_SIZE || head[0] != 'F' || head[1] != 'R')
+		return -1;
+	samples = (int)get_le(head + 2, 2);
+	bytes = (int)get_le(head + 4, 4);
+	if(samples == 0 || samples > (int)r->frame_samples ||
+		bytes < 0 || bytes > payload_bound(r->nChannels, r->frame_samples) ||
+		fread(r->payload, 1, bytes, r->f) != (size_t)bytes)
+		return -1;
+
+	b.p = r->payload;
+	b.end = r->payload + bytes;
+	b.acc = 0;
+	b.bits = 0;
+	b.overrun = 0;
+	for(c = 0; c < r->nChannels; c++)
+	{
+		if(decode_channel(&b, r->x, samples) != 0 || b.overrun)
+			return -1;
+		for(i = 0; i < samples; i++)
+			dst[i * r->nChannels + c] = map[r->x[i] + 128];
+	}
+	return samples;
+}
+
+/** @brief moves to the start of frame, which holds the samples from
+frame * frame_samples on. Needs the index. returns 0 on success */
+int g711pack_seek(struct g711pack_reader *r, uint32_t frame)
+{
+	if(!r->indexed || frame > r->frames)
+		return -1;
+	if(fseek(r->f, 0L, SEEK_SET) != 0)
+		return -1;
+	return wav_skip(r->f, r->index[frame]);
+}
+
+/** @brief frees what g711pack_open allocated */
+void g711pack_close(struct g711pack_reader *r)
+{
+	free(r->index);
+	free(r->payload);
+	free(r->x);
+	free(r->tail);
+	r->index = NULL;
+	r->payload = NULL;
+	r->x = NULL;
+	r->tail = NULL;
+}
@@ -0,0 +1,78 @@
+/** @file g711pack.h
+
+	@brief Lossless compression of G711 recordings, in the manner of
+	ITU-T G.711.0.
+
+	Each A-law or u-law byte is mapped to its position on the
+	amplitude scale, which turns the codes into a signal that can be
+	predicted. Every frame of every channel is coded with whichever
+	of constant, verbatim, a fixed polynomial predictor or a
+	quantised LPC predictor takes the fewest bits, and the residual is
+	Rice coded in partitions. Decoding gives back the original bytes
+	exactly.
+
+	A packed file is a small header, the frames, an index of the frame
+	offsets and a trailer that points at the index. Each frame carries
+	its own length, so a packed file can be decoded from a pipe, while
+	the index lets a seekable file be decoded from any frame.
+*/
+#ifndef G711PACK_H
+#define G711PACK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief samples per channel in a frame, 1/4 s at 8000 samples/second */
+#define G711PACK_FRAME 2048
+
+/** @brief state for reading a packed file */
+struct g711pack_reader {
+	/** @brief the packed file */
+	FILE *f;
+	/** @brief WAVE_FORMAT_ALAW or WAVE_FORMAT_MULAW */
+	uint16_t formattag;
+	/** @brief number of interleaved channels */
+	uint16_t nChannels;
+	/** @brief frames/second */
+	uint32_t frequency;
+	/** @brief samples per channel in every frame but the last */
+	uint32_t frame_samples;
+	/** @brief set when the index was read, which needs a seekable file */
+	int indexed;
+	/** @brief samples per channel in the file, when indexed */
+	uint64_t samples;
+	/** @brief number of frames, when indexed */
+	uint32_t frames;
+	/** @brief file offset of each frame, when indexed */
+	uint64_t *index;
+	/** @brief bytes after the last whole sample of every channel, which
+	g711pack_read_frame fills in when it reaches the index, and
+	g711pack_open already when indexed */
+	uint16_t tail_bytes;
+	/** @brief those bytes, room for nChannels */
+	unsigned char *tail;
+	/** @brief buffer for one packed frame */
+	unsigned char *payload;
+	/** @brief one channel of one frame as amplitude positions */
+	int *x;
+};
+
+/** @brief g711pack_open: the input does not start with a packed header */
+#define G711PACK_NOT_PACKED  -1
+/** @brief g711pack_open: a packed file this reader can not decode */
+#define G711PACK_UNSUPPORTED -2
+/** @brief g711pack_open: out of memory */
+#define G711PACK_NO_MEMORY   -3
+
+int  g711pack_encode(FILE *in, const struct wav_format *fmt, FILE *out, int threads, uint64_t *packed_bytes);
+int  g711pack_open(FILE *f, struct g711pack_reader *r);
+int  g711pack_read_frame(struct g711pack_reader *r, unsigned char *dst);
+int  g711pack_seek(struct g711pack_reader *r, uint32_t frame);
+void g711pack_close(struct g711pack_reader *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* G711PACK_H */
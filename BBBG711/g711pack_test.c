@@ -0,0 +1,129 @@
+/** @file g711pack_test.c
+
+	@brief Checks that g711_pack round trips byte for byte.
+
+	Each case packs synthetic G711 audio of a given length and channel
+	count into a temporary file, unpacks it frame by frame and compares
+	the result, tail included, with what went in. The lengths stop
+	short of a whole sample of every channel, of a whole frame, or
+	both. Exits with EXIT_FAILURE if any case does not come back as it
+	went in.
+*/
+#include "stdafx.h"
+#include "wavfile.h"
+#include "g711pack.h"
+
+/** @brief temporary files for the packed input and the packed output */
+#define TEST_INPUT L"g711pack_test.raw"
+#define TEST_PACKED L"g711pack_test.pk"
+
+/** @brief one round trip */
+struct pack_case {
+	/** @brief WAVE_FORMAT_ALAW or WAVE_FORMAT_MULAW */
+	uint16_t formattag;
+	/** @brief interleaved channels */
+	uint16_t channels;
+	/** @brief bytes of audio */
+	uint32_t bytes;
+};
+
+static const struct pack_case cases[] = {
+	/* stereo cut short by one byte */
+	{ WAVE_FORMAT_MULAW, 2, 10005 },
+	{ WAVE_FORMAT_ALAW, 2, 10005 },
+	/* less than one sample of every channel */
+	{ WAVE_FORMAT_ALAW, 3, 2 },
+	/* a whole number of frames, then part of a sample */
+	{ WAVE_FORMAT_MULAW, 3, 3 * G711PACK_FRAME * 2 + 2 },
+	/* mono has no tail */
+	{ WAVE_FORMAT_ALAW, 1, G711PACK_FRAME + 1 },
+	{ WAVE_FORMAT_ALAW, 2, 0 }
+};
+
+/** @brief fills audio with a tone that drifts in level, plus a
+little noise, so every subframe type turns up */
+static void synthesize(unsigned char *audio, uint32_t bytes)
+{
+	uint32_t i, seed = 1;
+
+	for (i = 0; i < bytes; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		audio[i] = (unsigned char)((i / 7) % 32 + (i / 4096) * 16 + ((seed >> 16) & 3));
+	}
+}
+
+/** @brief packs and unpacks one case. returns 0 if it came back
+byte for byte */
+static int round_trip(const struct pack_case *c)
+{
+	struct wav_format fmt;
+	struct g711pack_reader r;
+	unsigned char *audio, *frame;
+	FILE *in, *out;
+	uint64_t at = 0;
+	int samples, result = -1;
+
+	audio = (unsigned char *)malloc(c->bytes + 1);
+	frame = (unsigned char *)malloc(G711PACK_FRAME * c->channels);
+	if (audio == NULL || frame == NULL)
+		goto done;
+	synthesize(audio, c->bytes);
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.formattag = c->formattag;
+	fmt.nChannels = c->channels;
+	fmt.frequency = 8000;
+	fmt.bits_per_sample = 8;
+	fmt.data_bytes = c->bytes;
+
+	in = _wfopen(TEST_INPUT, L"w+b");
+	out = _wfopen(TEST_PACKED, L"w+b");
+	if (in == NULL || out == NULL ||
+		fwrite(audio, 1, c->bytes, in) != c->bytes || fseek(in, 0L, SEEK_SET) != 0 ||
+		g711pack_encode(in, &fmt, out, 2, NULL) != 0 || fseek(out, 0L, SEEK_SET) != 0 ||
+		g711pack_open(out, &r) != 0)
+		goto close;
+	if (r.indexed && r.samples * c->channels + r.tail_bytes == c->bytes)
+	{
+		while ((samples = g711pack_read_frame(&r, frame)) > 0)
+		{
+			if (at + (uint64_t)samples * c->channels > c->bytes ||
+				memcmp(frame, audio + at, samples * c->channels) != 0)
+				break;
+			at += (uint64_t)samples * c->channels;
+		}
+		if (samples == 0 && at + r.tail_bytes == c->bytes &&
+			memcmp(r.tail, audio + at, r.tail_bytes) == 0)
+			result = 0;
+	}
+	g711pack_close(&r);
+close:
+	if (in != NULL)
+		fclose(in);
+	if (out != NULL)
+		fclose(out);
+	DeleteFileW(TEST_INPUT);
+	DeleteFileW(TEST_PACKED);
+done:
+	free(frame);
+	free(audio);
+	return result;
+}
+
+int wmain(int argc, wchar_t *argv[])
+{
+	int i, failed = 0;
+
+	for (i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++)
+	{
+		if (round_trip(&cases[i]) != 0)
+		{
+			printf("FAIL %s, %d channels, %lu bytes\n",
+				cases[i].formattag == WAVE_FORMAT_MULAW ? "u-law" : "A-law",
+				cases[i].channels, (unsigned long)cases[i].bytes);
+			failed++;
+		}
+	}
+	printf("%d of %d round trips failed\n", failed, i);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
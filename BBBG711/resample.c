@@ -0,0 +1,205 @@
+/** @file resample.c
+
+	@brief Streaming polyphase FIR resampler for 16 bit PCM.
+
+	The prototype low pass filter is a Kaiser windowed sinc designed
+	at in_rate*up. It is split into up branches so each output sample
+	only costs one branch of taps multiply-accumulates, which keeps
+	44.1/48 kHz -> 8 kHz cheap enough for the ARM target. The history
+	is stored twice back to back so every branch is a straight dot
+	product over contiguous memory, without wrapping.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "resample.h"
+
+/** @brief Kaiser window shape, roughly 80 dB of stopband */
+#define KAISER_BETA 8.0
+/** @brief pass band edge as a fraction of the output Nyquist rate */
+#define CUTOFF 0.9
+
+static int gcd(int a, int b)
+{
+	int t;
+
+	while (b != 0)
+	{
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/** @brief zeroth order modified Bessel function, for the Kaiser window */
+static double bessel_i0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	int k;
+
+	for (k = 1; k < 32; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+/** @brief initializes the resampler, returns 0 on success */
+int resampler_init(struct resampler *r, int in_rate, int out_rate, int channels)
+{
+	int g, n, len, p, k;
+	double fc, t, w, h;
+
+	memset(r, 0, sizeof(*r));
+	if (in_rate <= 0 || out_rate <= 0 || channels <= 0)
+		return -1;
+	g = gcd(in_rate, out_rate);
+	r->up = out_rate / g;
+	r->down = in_rate / g;
+	r->channels = channels;
+
+	/* a decimating filter has to be proportionally longer */
+	r->taps = RESAMPLE_TAPS;
+	if (r->down > r->up)
+		r->taps = (RESAMPLE_TAPS * r->down + r->up - 1) / r->up;
+
+	r->coeffs = (short *)calloc(r->up * r->taps, sizeof(short));
+	r->history = (short *)calloc(2 * r->taps * channels, sizeof(short));
+	if (r->coeffs == NULL || r->history == NULL)
+	{
+		resampler_free(r);
+		return -1;
+	}
+
+	/* cutoff in cycles per sample of the upsampled stream */
+	fc = 0.5 * CUTOFF / (r->up > r->down ? r->up : r->down);
+	len = r->up * r->taps;
+	for (n = 0; n < len; n++)
+	{
+		t = n - (len - 1) / 2.0;
+		w = 2.0 * t / (len - 1);
+		w = bessel_i0(KAISER_BETA * sqrt(1.0 - w * w)) / bessel_i0(KAISER_BETA);
+		h = (t == 0.0) ? 2.0 * fc : sin(2.0 * 3.14159265358979 * fc * t) / (3.14159265358979 * t);
+		/* gain of up makes up for the zeros stuffed in by interpolation */
+		h *= w * r->up * 16384.0;
+		/* branch p holds prototype taps p, p+up, ... with the newest
+		   input sample last, matching the history layout */
+		p = n % r->up;
+		k = n / r->up;
+		r->coeffs[p * r->taps + (r->taps - 1 - k)] = (short)(h < 0.0 ? h - 0.5 : h + 0.5);
+	}
+	/* the prototype is centred (len - 1) / 2 upsampled steps back */
+	r->delay = (int)((len - 1) / 2.0 / r->down + 0.5);
+	r->skip = r->delay;
+	return 0;
+}
+
+/** @brief upper bound on the frames produced for src_frames of input */
+int resampler_max_output(const struct resampler *r, int src_frames)
+{
+	return (int)(((double)src_frames * r->up) / r->down) + 1;
+}
+
+/** @brief one output sample: branch coefficients against the history */
+static short dot(const short *coeffs, const short *samples, int taps)
+{
+	long acc = 0;
+	int i;
+
+	for (i = 0; i + 4 <= taps; i += 4)
+	{
+		acc += (long)coeffs[i] * samples[i]
+			+ (long)coeffs[i + 1] * samples[i + 1]
+			+ (long)coeffs[i + 2] * samples[i + 2]
+			+ (long)coeffs[i + 3] * samples[i + 3];
+	}
+	for (; i < taps; i++)
+		acc += (long)coeffs[i] * samples[i];
+
+	acc = (acc + (1 << 13)) >> 14;
+	if (acc > 32767)
+		acc = 32767;
+	else if (acc < -32768)
+		acc = -32768;
+	return (short)acc;
+}
+
+/** @brief runs src_frames frames through the filter, dropping the 
+delay first. Frames past limit are computed but not written. returns
+the number of frames written */
+static int run(struct resampler *r, const short *src_samples, int src_frames, short *dst_samples, int limit)
+{
+	int i, c;
+	int out = 0;
+	int taps = r->taps;
+	short *hist;
+
+	for (i = 0; i < src_frames; i++)
+	{
+		for (c = 0; c < r->channels; c++)
+		{
+			hist = r->history + c * 2 * taps;
+			hist[r->pos] = src_samples ? src_samples[i * r->channels + c] : 0;
+			hist[r->pos + taps] = hist[r->pos];
+		}
+		r->pos++;
+		if (r->pos == taps)
+			r->pos = 0;
+
+		while (r->phase < r->up)
+		{
+			if (r->skip > 0)
+				r->skip--;
+			else if (out < limit)
+			{
+				for (c = 0; c < r->channels; c++)
+				{
+					hist = r->history + c * 2 * taps + r->pos;
+					dst_samples[out * r->channels + c] = dot(r->coeffs + r->phase * taps, hist, taps);
+				}
+				out++;
+			}
+			r->phase += r->down;
+		}
+		r->phase -= r->up;
+	}
+	return out;
+}
+
+/** @brief resamples src_frames interleaved frames into dst_samples and
+	returns the number of frames written, at most resampler_max_output() */
+int resampler_process(struct resampler *r, const short *src_samples, int src_frames, short *dst_samples)
+{
+	return run(r, src_samples, src_frames, dst_samples, resampler_max_output(r, src_frames));
+}
+
+/** @brief ends the stream: feeds zeros until the frames held back by 
+	the delay are out, and returns their number, at most 
+	resampler_max_output(r, r->taps). The resampler is then ready for a
+	new stream. */
+int resampler_flush(struct resampler *r, short *dst_samples)
+{
+	/* the delay is owed, less whatever is still to be dropped */
+	int owed = r->delay - r->skip;
+	int out = 0;
+
+	while (out < owed)
+		out += run(r, NULL, 1, dst_samples + out * r->channels, owed - out);
+	memset(r->history, 0, 2 * r->taps * r->channels * sizeof(short));
+	r->pos = 0;
+	r->phase = 0;
+	r->skip = r->delay;
+	return out;
+}
+
+/** @brief releases the filter and history */
+void resampler_free(struct resampler *r)
+{
+	free(r->coeffs);
+	free(r->history);
+	r->coeffs = NULL;
+	r->history = NULL;
+}
@@ -0,0 +1,59 @@
+/** @file resample.h
+
+	@brief Streaming polyphase FIR resampler for 16 bit PCM.
+
+	Converts between any two integer sample rates by the rational
+	ratio up/down (e.g. 44100 -> 8000 is 80/441). Samples are
+	interleaved, and the filter history of every channel is carried
+	across calls so the input may be fed in blocks of any size.
+
+	The filter delay is taken out: the output starts level with the
+	input, and resampler_flush() at the end of the stream brings out
+	the last half filter, so n input frames give exactly
+	ceil(n * out_rate / in_rate) output frames.
+*/
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief taps per polyphase branch when not decimating */
+#define RESAMPLE_TAPS 16
+
+/** @brief state of one resampler */
+struct resampler {
+	/** @brief interpolation factor */
+	int up;
+	/** @brief decimation factor */
+	int down;
+	/** @brief number of interleaved channels */
+	int channels;
+	/** @brief taps in each polyphase branch */
+	int taps;
+	/** @brief Q14 coefficients, up branches of taps each */
+	short *coeffs;
+	/** @brief per channel history, 2*taps samples each */
+	short *history;
+	/** @brief write position in the history */
+	int pos;
+	/** @brief current polyphase branch */
+	int phase;
+	/** @brief filter delay in output frames */
+	int delay;
+	/** @brief output frames of the delay still to drop */
+	int skip;
+};
+
+int  resampler_init(struct resampler *r, int in_rate, int out_rate, int channels);
+int  resampler_process(struct resampler *r, const short *src_samples, int src_frames, short *dst_samples);
+int  resampler_flush(struct resampler *r, short *dst_samples);
+int  resampler_max_output(const struct resampler *r, int src_frames);
+void resampler_free(struct resampler *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RESAMPLE_H */
@@ -63,4 +63,6 @@ typedef unsigned __int32 uint32_t;
 typedef unsigned short uint16_t;
 /** @brief so we can use the type uint8_t */
 typedef unsigned char uint8_t;
+/** @brief so we can use the type uint64_t, for files over 4GB */
+typedef unsigned __int64 uint64_t;
 // TODO: reference additional headers your program requires here
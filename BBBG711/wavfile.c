@@ -0,0 +1,393 @@
+/** @file wavfile.c
+
+	@brief Reading and writing of the RIFF, RF64 and Wave64 containers.
+
+	Fields are packed and unpacked a byte at a time so the layout does
+	not depend on structure padding. The reader takes the chunks in
+	whatever order they come: it uses ds64 (RF64 only), fmt and data
+	and skips the rest. When data comes before fmt it goes on to find
+	fmt and then seeks back to the audio.
+*/
+#include "stdafx.h"
+#include "wavfile.h"
+
+/** @brief 32 bit size meaning "look in the ds64 chunk" */
+#define RF64_SIZE_IN_DS64 0xFFFFFFFFUL
+
+/** @brief the Wave64 chunk GUIDs, in file byte order */
+static const uint8_t w64_riff[16] = {0x72,0x69,0x66,0x66,0x2E,0x91,0xCF,0x11,0xA5,0xD6,0x28,0xDB,0x04,0xC1,0x00,0x00};
+static const uint8_t w64_wave[16] = {0x77,0x61,0x76,0x65,0xF3,0xAC,0xD3,0x11,0x8C,0xD1,0x00,0xC0,0x4F,0x8E,0xDB,0x8A};
+static const uint8_t w64_fmt[16]  = {0x66,0x6D,0x74,0x20,0xF3,0xAC,0xD3,0x11,0x8C,0xD1,0x00,0xC0,0x4F,0x8E,0xDB,0x8A};
+static const uint8_t w64_fact[16] = {0x66,0x61,0x63,0x74,0xF3,0xAC,0xD3,0x11,0x8C,0xD1,0x00,0xC0,0x4F,0x8E,0xDB,0x8A};
+static const uint8_t w64_data[16] = {0x64,0x61,0x74,0x61,0xF3,0xAC,0xD3,0x11,0x8C,0xD1,0x00,0xC0,0x4F,0x8E,0xDB,0x8A};
+
+static uint16_t get16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+	return (uint64_t)get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+static uint8_t * put16(uint8_t *p, uint16_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	return p + 2;
+}
+
+static uint8_t * put32(uint8_t *p, uint32_t v)
+{
+	p = put16(p, (uint16_t)v);
+	return put16(p, (uint16_t)(v >> 16));
+}
+
+static uint8_t * put64(uint8_t *p, uint64_t v)
+{
+	p = put32(p, (uint32_t)v);
+	return put32(p, (uint32_t)(v >> 32));
+}
+
+static uint8_t * put_id(uint8_t *p, const void *id, int size)
+{
+	memcpy(p, id, size);
+	return p + size;
+}
+
+/** @brief where messages go, NULL for stdout */
+static FILE *messages;
+
+/** @brief the stream messages go to */
+static FILE *log_stream()
+{
+	return messages != NULL ? messages : stdout;
+}
+
+/** @brief sends the messages and wav_print() to f instead of stdout,
+for when stdout carries the audio */
+void wav_messages(FILE *f)
+{
+	messages = f;
+}
+
+/** @brief skips bytes of input, also on streams that can not seek.
+returns 0 on success */
+int wav_skip(FILE *f, uint64_t bytes)
+{
+	char scratch[512];
+	long step;
+
+	while (bytes > 0)
+	{
+		step = bytes > 0x40000000 ? 0x40000000 : (long)bytes;
+		if (fseek(f, step, SEEK_CUR) != 0)
+		{
+			if (step > (long)sizeof(scratch))
+				step = sizeof(scratch);
+			if (fread(scratch, 1, step, f) != (size_t)step)
+				return -1;
+		}
+		bytes -= step;
+	}
+	return 0;
+}
+
+/** @brief unpacks a fmt chunk. WAVE_FORMAT_EXTENSIBLE carries the
+real format tag in the first two bytes of its sub format GUID.
+cb_size gets the extension size, or -1 when the chunk has none. */
+static int read_fmt(FILE *f, uint64_t size, struct wav_format *fmt, int *cb_size)
+{
+	uint8_t buf[40];
+	int n = size < 40 ? (int)size : 40;
+
+	if (size < 16 || fread(buf, 1, n, f) != (size_t)n)
+		return -1;
+	fmt->formattag = get16(buf);
+	fmt->nChannels = get16(buf + 2);
+	fmt->frequency = get32(buf + 4);
+	fmt->bits_per_sample = get16(buf + 14);
+	*cb_size = n >= 18 ? get16(buf + 16) : -1;
+	if (fmt->nChannels == 0 || fmt->frequency == 0)
+	{
+		fprintf(log_stream(), "The fmt chunk has no channels or no sample rate.\n");
+		return -1;
+	}
+	if (fmt->formattag == WAVE_FORMAT_EXTENSIBLE)
+	{
+		if (n < 40)
+			return -1;
+		fmt->formattag = get16(buf + 24);
+	}
+	return wav_skip(f, size - n);
+}
+
+/** @brief reads the next chunk header. Wave64 GUIDs are folded to the
+four character code they embed, unknown GUIDs come back as "????".
+Sizes are of the payload only. returns 0 on success */
+static int read_chunk(FILE *f, int container, uint8_t *id, uint64_t *size)
+{
+	uint8_t buf[24];
+
+	if (container == WAV_W64)
+	{
+		if (fread(buf, 1, 24, f) != 24 || get64(buf + 16) < 24)
+			return -1;
+		if (memcmp(buf + 4, w64_fmt + 4, 12) == 0)
+			memcpy(id, buf, 4);
+		else
+			memcpy(id, "????", 4);
+		*size = get64(buf + 16) - 24;
+		return 0;
+	}
+	if (fread(buf, 1, 8, f) != 8)
+		return -1;
+	memcpy(id, buf, 4);
+	*size = get32(buf + 4);
+	return 0;
+}
+
+/** @brief walks the chunks after the RIFF/RF64/Wave64 header, which is
+header_size bytes long. Chunks it does not need (LIST, bext, JUNK, 
+fact, ...) are skipped by size without reading them. It stops at the 
+data chunk once fmt has been seen. If data comes first the payload 
+is skipped and the file seeked back to it afterwards. */
+static int walk_chunks(FILE *f, struct wav_format *fmt, uint64_t header_size, uint64_t riff_size)
+{
+	uint8_t id[4];
+	uint8_t buf[28];
+	uint64_t offset = header_size;
+	uint64_t size;
+	uint64_t ds64_data = 0;
+	int chunk_header = fmt->container == WAV_W64 ? 24 : 8;
+	int align = fmt->container == WAV_W64 ? 8 : 2;
+	int have_fmt = 0;
+	int have_data = 0;
+	int cb_size = -1;
+	uint64_t fmt_size = 0;
+
+	for (;;)
+	{
+		if (read_chunk(f, fmt->container, id, &size) != 0)
+			return -1;
+		offset += chunk_header;
+		if (memcmp(id, "ds64", 4) == 0 && fmt->container == WAV_RF64)
+		{
+			if (size < 28 || fread(buf, 1, 28, f) != 28 || wav_skip(f, size - 28) != 0)
+				return -1;
+			/* riff size, data size, sample count, table length */
+			ds64_data = get64(buf + 8);
+		}
+		else if (memcmp(id, "fmt ", 4) == 0 && !have_fmt)
+		{
+			if (read_fmt(f, size, fmt, &cb_size) != 0)
+				return -1;
+			fmt_size = size;
+			fmt->fmt_offset = offset;
+			have_fmt = 1;
+		}
+		else if (memcmp(id, "data", 4) == 0 && !have_data)
+		{
+			if (fmt->container == WAV_RF64 && size == RF64_SIZE_IN_DS64)
+				size = ds64_data;
+			/* a writer that streams can not know the length up front,
+			and leaves all ones in its place */
+			if (size == WAV_SIZE_UNKNOWN || (fmt->container == WAV_RIFF && size == 0xFFFFFFFFUL))
+				size = WAV_SIZE_UNKNOWN;
+			/* 0 is an empty chunk, unless the RIFF size is a placeholder
+			too. An empty Wave64 data chunk is how wav_write_header()
+			marks a stream. */
+			else if (size == 0 && (fmt->container == WAV_W64 ||
+				(fmt->container == WAV_RIFF && (riff_size == 0 || riff_size == 0xFFFFFFFFUL))))
+				size = WAV_SIZE_UNKNOWN;
+			fmt->data_bytes = size;
+			fmt->data_offset = offset;
+			have_data = 1;
+			if (have_fmt)
+				break;
+			if (size == WAV_SIZE_UNKNOWN)
+			{
+				fprintf(log_stream(), "The data chunk of unknown length comes before fmt.\n");
+				return -1;
+			}
+			if (wav_skip(f, size) != 0)
+				return -1;
+		}
+		else
+		{
+			if (fmt->container == WAV_W64)
+				fprintf(log_stream(), "skipping Wave64 chunk (%.0f bytes)\n", (double)size);
+			else
+				fprintf(log_stream(), "skipping chunk %c%c%c%c (%.0f bytes)\n", id[0], id[1], id[2], id[3], (double)size);
+			if (wav_skip(f, size) != 0)
+				return -1;
+		}
+		if (have_fmt && have_data)
+			return wav_seek_data(f, fmt);
+		/* chunks are padded to even (RIFF) or 8 byte (Wave64) sizes */
+		if (wav_skip(f, (align - size % align) % align) != 0)
+			return -1;
+		offset += size + (align - size % align) % align;
+	}
+
+	/* the G711 header of this tool has an 18 byte fmt with a cbSize 
+	of 0, a 0xFFFF word after the data size, and a RIFF size of the 
+	whole file (8 more than the standard), or all ones when streaming.
+	Step over the pad so the audio lines up. */
+	if ((fmt->formattag == WAVE_FORMAT_ALAW || fmt->formattag == WAVE_FORMAT_MULAW) &&
+		fmt->container == WAV_RIFF && fmt_size == 18 && cb_size == 0 &&
+		(riff_size == fmt->data_offset + 2 + fmt->data_bytes ||
+		(riff_size == 0xFFFFFFFFUL && fmt->data_bytes == WAV_SIZE_UNKNOWN)))
+	{
+		if (fread(buf, 1, 2, f) != 2 || buf[0] != 0xFF || buf[1] != 0xFF)
+			return -1;
+		fmt->data_offset += 2;
+		fmt->legacy_pad = 1;
+	}
+	return 0;
+}
+
+/** @brief reads the container and format, and leaves the file at
+the first byte of audio. returns 0 on success */
+int wav_read_header(FILE *f, struct wav_format *fmt)
+{
+	uint8_t buf[40];
+
+	memset(fmt, 0, sizeof(*fmt));
+	if (fread(buf, 1, 12, f) != 12)
+		return -1;
+	if (memcmp(buf, "RIFF", 4) == 0 && memcmp(buf + 8, "WAVE", 4) == 0)
+	{
+		fmt->container = WAV_RIFF;
+		return walk_chunks(f, fmt, 12, get32(buf + 4));
+	}
+	if (memcmp(buf, "RF64", 4) == 0 && memcmp(buf + 8, "WAVE", 4) == 0)
+	{
+		fmt->container = WAV_RF64;
+		return walk_chunks(f, fmt, 12, 0);
+	}
+	if (memcmp(buf, w64_riff, 12) == 0)
+	{
+		if (fread(buf + 12, 1, 28, f) != 28 || memcmp(buf, w64_riff, 16) != 0 ||
+			memcmp(buf + 24, w64_wave, 16) != 0)
+			return -1;
+		fmt->container = WAV_W64;
+		return walk_chunks(f, fmt, 40, 0);
+	}
+	fprintf(log_stream(), "Input is not a RIFF, RF64 or Wave64 file.\n");
+	return -1;
+}
+
+/** @brief positions the file at the first byte of audio, using the 
+offset found by wav_read_header. returns 0 on success */
+int wav_seek_data(FILE *f, const struct wav_format *fmt)
+{
+	if (fseek(f, 0L, SEEK_SET) != 0)
+	{
+		fprintf(log_stream(), "The data chunk comes before fmt, and the input can not seek.\n");
+		return -1;
+	}
+	return wav_skip(f, fmt->data_offset);
+}
+
+/** @brief writes an RF64 or Wave64 header for fmt, ready for
+fmt->data_bytes of audio to follow. When that is WAV_SIZE_UNKNOWN
+RF64 gets all ones and Wave64 an empty data chunk, both of which
+wav_read_header() takes as "read to the end". returns 0 on success */
+int wav_write_header(FILE *f, const struct wav_format *fmt)
+{
+	uint8_t buf[160];
+	uint8_t *p = buf;
+	int g711 = fmt->formattag == WAVE_FORMAT_ALAW || fmt->formattag == WAVE_FORMAT_MULAW;
+	uint16_t block_align = fmt->nChannels * (fmt->bits_per_sample / 8);
+	uint32_t fmt_size = g711 ? 18 : 16;
+	int unknown = fmt->data_bytes == WAV_SIZE_UNKNOWN;
+	uint64_t data_bytes = unknown ? 0 : fmt->data_bytes;
+	uint64_t samples = unknown ? WAV_SIZE_UNKNOWN : data_bytes / (block_align ? block_align : 1);
+	uint64_t header_size;
+
+	if (fmt->container == WAV_W64)
+	{
+		/* riff + wave, fmt padded to 8 bytes, fact, data */
+		header_size = 40 + 24 + ((fmt_size + 7) & ~7) + (g711 ? 32 : 0) + 24;
+		p = put_id(p, w64_riff, 16);
+		p = put64(p, header_size + ((data_bytes + 7) & ~(uint64_t)7));
+		p = put_id(p, w64_wave, 16);
+		p = put_id(p, w64_fmt, 16);
+		p = put64(p, 24 + fmt_size);
+	}
+	else
+	{
+		header_size = 12 + 36 + 8 + fmt_size + (g711 ? 12 : 0) + 8;
+		p = put_id(p, "RF64", 4);
+		p = put32(p, RF64_SIZE_IN_DS64);
+		p = put_id(p, "WAVE", 4);
+		p = put_id(p, "ds64", 4);
+		p = put32(p, 28);
+		p = put64(p, unknown ? WAV_SIZE_UNKNOWN : header_size - 8 + data_bytes + (data_bytes & 1));
+		p = put64(p, fmt->data_bytes);
+		p = put64(p, samples);
+		p = put32(p, 0);
+		p = put_id(p, "fmt ", 4);
+		p = put32(p, fmt_size);
+	}
+	p = put16(p, fmt->formattag);
+	p = put16(p, fmt->nChannels);
+	p = put32(p, fmt->frequency);
+	p = put32(p, fmt->frequency * block_align);
+	p = put16(p, block_align);
+	p = put16(p, fmt->bits_per_sample);
+	if (g711)
+		p = put16(p, 0);
+	if (fmt->container == WAV_W64)
+	{
+		while ((p - buf) & 7)
+			*p++ = 0;
+		if (g711)
+		{
+			p = put_id(p, w64_fact, 16);
+			p = put64(p, 32);
+			p = put64(p, samples);
+		}
+		p = put_id(p, w64_data, 16);
+		p = put64(p, 24 + data_bytes);
+	}
+	else
+	{
+		if (g711)
+		{
+			p = put_id(p, "fact", 4);
+			p = put32(p, 4);
+			p = put32(p, samples > 0xFFFFFFFFUL ? RF64_SIZE_IN_DS64 : (uint32_t)samples);
+		}
+		p = put_id(p, "data", 4);
+		p = put32(p, RF64_SIZE_IN_DS64);
+	}
+	if (fwrite(buf, 1, p - buf, f) != (size_t)(p - buf))
+		return -1;
+	return 0;
+}
+
+/** @brief prints the format, for any container */
+void wav_print(const struct wav_format *fmt)
+{
+	static const char *names[] = {"RIFF", "RF64", "Wave64"};
+
+	fprintf(log_stream(), "\n\n%s header\n", names[fmt->container]);
+	fprintf(log_stream(), "format tag: %d\n", fmt->formattag);
+	fprintf(log_stream(), "channels: %d\n", fmt->nChannels);
+	fprintf(log_stream(), "sample rate: %lu samples/second\n", (unsigned long)fmt->frequency);
+	fprintf(log_stream(), "bits per sample: %d\n", fmt->bits_per_sample);
+	/* through double, which is exact well past any real file size */
+	if (fmt->data_bytes == WAV_SIZE_UNKNOWN)
+		fprintf(log_stream(), "bytes in data: unknown, read to the end\n");
+	else
+		fprintf(log_stream(), "bytes in data: %.0f\n", (double)fmt->data_bytes);
+	fprintf(log_stream(), "data offset: %.0f\n\n", (double)fmt->data_offset);
+}
@@ -0,0 +1,76 @@
+/** @file wavfile.h
+
+	@brief Reading and writing of the RIFF, RF64 and Wave64 containers.
+
+	Plain RIFF stores sizes in 32 bits, which limits a file to 4GB.
+	RF64 keeps the RIFF layout but moves the sizes into a 64 bit ds64
+	chunk, and Sony Wave64 uses GUID chunk ids with 64 bit sizes
+	throughout. Sizes and offsets here are always 64 bit.
+*/
+#ifndef WAVFILE_H
+#define WAVFILE_H
+
+/* the format tags may already come in through mmreg.h */
+#ifndef WAVE_FORMAT_PCM
+/** @brief format tag for integer PCM */
+#define WAVE_FORMAT_PCM 1
+#endif
+#ifndef WAVE_FORMAT_IEEE_FLOAT
+/** @brief format tag for IEEE float PCM */
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#endif
+#ifndef WAVE_FORMAT_ALAW
+/** @brief format tag for A-law */
+#define WAVE_FORMAT_ALAW 6
+#endif
+#ifndef WAVE_FORMAT_MULAW
+/** @brief format tag for u-law */
+#define WAVE_FORMAT_MULAW 7
+#endif
+#ifndef WAVE_FORMAT_EXTENSIBLE
+/** @brief format tag whose real format is in the sub format GUID */
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+#endif
+
+/** @brief classic RIFF/WAVE, 32 bit sizes */
+#define WAV_RIFF 0
+/** @brief EBU RF64, RIFF with a ds64 chunk */
+#define WAV_RF64 1
+/** @brief Sony Wave64 */
+#define WAV_W64 2
+
+/** @brief data_bytes of a stream whose length was not known when
+its header was written */
+#define WAV_SIZE_UNKNOWN ((uint64_t)-1)
+
+/** @brief what a conversion needs to know about a wav file */
+struct wav_format {
+	/** @brief WAV_RIFF, WAV_RF64 or WAV_W64 */
+	int container;
+	/** @brief 1 PCM, 3 float, 6 A-law, 7 u-law */
+	uint16_t formattag;
+	/** @brief number of interleaved channels */
+	uint16_t nChannels;
+	/** @brief frames/second */
+	uint32_t frequency;
+	/** @brief bits in one sample of one channel */
+	uint16_t bits_per_sample;
+	/** @brief size of the audio payload in bytes, or WAV_SIZE_UNKNOWN */
+	uint64_t data_bytes;
+	/** @brief offset of the fmt payload from the start of the file */
+	uint64_t fmt_offset;
+	/** @brief offset of the first audio byte from the start of the file */
+	uint64_t data_offset;
+	/** @brief set when the data was written by older versions of this
+	tool, which put two pad bytes between the data size and the audio */
+	int legacy_pad;
+};
+
+int  wav_read_header(FILE *f, struct wav_format *fmt);
+int  wav_write_header(FILE *f, const struct wav_format *fmt);
+int  wav_seek_data(FILE *f, const struct wav_format *fmt);
+int  wav_skip(FILE *f, uint64_t bytes);
+void wav_print(const struct wav_format *fmt);
+void wav_messages(FILE *f);
+
+#endif /* WAVFILE_H */